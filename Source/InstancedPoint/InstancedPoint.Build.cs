@@ -40,6 +40,8 @@ public class InstancedPoint : ModuleRules
 			{
 				"CoreUObject",
 				"Engine",
+				"RenderCore",
+				"RHI",
 				"Slate",
 				"SlateCore",
 				"UMG",
@@ -4,6 +4,16 @@
 #include "HIPointAndNameActor.h"
 #include "Components/HierarchicalInstancedStaticMeshComponent.h"
 #include "Components/WidgetComponent.h"
+#include "InstancedPoint.h"
+#include "HIPointMeshComponent.h"
+#include "InstancedPointSubsystem.h"
+#include "PointMaterialBillboard.h"
+#include "PointNameWidget.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Name Widget Pool Hits"), STAT_NameWidgetPoolHits, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Name Widget Pool Misses"), STAT_NameWidgetPoolMisses, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Name Widget Pool Exhausted"), STAT_NameWidgetPoolExhausted, STATGROUP_InstancedPoint);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Name Widgets Live"), STAT_NameWidgetsLive, STATGROUP_InstancedPoint);
 
 // Sets default values
 AHIPointAndNameActor::AHIPointAndNameActor()
@@ -11,19 +21,48 @@ AHIPointAndNameActor::AHIPointAndNameActor()
  	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = true;
 
-	HIPoint = CreateDefaultSubobject<UHierarchicalInstancedStaticMeshComponent>(TEXT("HIPoint"));
+	HIPoint = CreateDefaultSubobject<UHIPointMeshComponent>(TEXT("HIPoint"));
 	HIPoint->CastShadow = 0;
 
 	//PointName = CreateDefaultSubobject<UWidgetComponent>(TEXT("PointName"));
 }
 
+void AHIPointAndNameActor::PostInitializeComponents()
+{
+	Super::PostInitializeComponents();
+
+	//Instances added, removed or moved by anyone else make the location cache stale
+	if (UHIPointMeshComponent* PointMesh = Cast<UHIPointMeshComponent>(HIPoint))
+	{
+		PointMesh->OnInstancesChanged.AddUObject(this, &AHIPointAndNameActor::InvalidateLocationCache);
+	}
+}
+
 // Called when the game starts or when spawned
 void AHIPointAndNameActor::BeginPlay()
 {
 	Super::BeginPlay();
 
 	SetBoundsSize();
-	
+
+	if (NameWidgetClass)
+	{
+		const int32 WarmSize = NameWidgetPoolMaxSize > 0 ? FMath::Min(NameWidgetPoolWarmSize, NameWidgetPoolMaxSize) : NameWidgetPoolWarmSize;
+		while (NumNameWidgets < WarmSize)
+		{
+			UWidgetComponent* Widget = CreateNameWidget();
+			Widget->SetVisibility(false);
+			FreeNameWidgets.Add(Widget);
+		}
+	}
+}
+
+void AHIPointAndNameActor::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	DEC_DWORD_STAT_BY(STAT_NameWidgetsLive, NumNameWidgets);
+	NumNameWidgets = 0;
+
+	Super::EndPlay(EndPlayReason);
 }
 
 // Called every frame
@@ -53,124 +92,262 @@ void AHIPointAndNameActor::SetLockZ(bool Lock)
 	bLockZ = Lock;
 }
 
+/**
+ * Writes of the apply pass. With bVisibilityCustomData hidden instances keep their
+ * transform and only the custom data flag changes, picked once per update.
+ */
+template<bool bVisibilityCustomData>
+struct THIPointNameApplySink
+{
+	AHIPointAndNameActor& Actor;
+	const FRotator& Rotator;
+	float CollapsedScale;
+
+	THIPointNameApplySink(AHIPointAndNameActor& InActor, const FRotator& InRotator, float InCollapsedScale)
+		: Actor(InActor)
+		, Rotator(InRotator)
+		, CollapsedScale(InCollapsedScale)
+	{
+	}
+
+	FORCEINLINE void Collapse(int32 InstIndex, const FVector& Location)
+	{
+		if (bVisibilityCustomData)
+		{
+			Actor.HIPoint->SetCustomDataValue(InstIndex, Actor.VisibilityCustomDataIndex, 0.0f, true);
+		}
+		else
+		{
+			//ScaleΪ0ģͼ
+			Actor.HIPoint->UpdateInstanceTransform(InstIndex, FTransform(FRotator(1.0, 1.0, 1.0), Location, FVector(CollapsedScale)), true, true);
+		}
+		Actor.LocationCache.AppliedScale[InstIndex] = CollapsedScale;
+	}
+
+	FORCEINLINE void Billboard(int32 InstIndex, const FVector& Location, float Scale)
+	{
+		const FTransform NewTransform = FTransform(Rotator, Location, FVector(Scale));
+		if (NewTransform.ContainsNaN())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Instance transform ContainsNaN"));
+		}
+		Actor.HIPoint->UpdateInstanceTransform(InstIndex, NewTransform, true, true);
+
+		//Hidden instances read as collapsed in the location cache
+		if (bVisibilityCustomData && Actor.LocationCache.AppliedScale[InstIndex] == CollapsedScale)
+		{
+			Actor.HIPoint->SetCustomDataValue(InstIndex, Actor.VisibilityCustomDataIndex, 1.0f, true);
+		}
+		Actor.LocationCache.AppliedScale[InstIndex] = Scale;
+	}
+
+	FORCEINLINE void OffScreen(int32 InstIndex, const FVector& Location)
+	{
+		//Off screen instances keep their last transform
+	}
+
+	FORCEINLINE void Select(int32 InstIndex, const FVector& Location, float Distance)
+	{
+		Collapse(InstIndex, Location);
+	}
+
+	FORCEINLINE void Name(int32 InstIndex, const FVector& Location, float Distance)
+	{
+		//жǷʾName
+		if (Distance < Actor.NameCullingDistance)
+		{
+			Actor.ShowName(InstIndex, Location);
+		}
+		else
+		{
+			Actor.HideName(InstIndex);
+		}
+	}
+
+	FORCEINLINE void HideName(int32 InstIndex)
+	{
+		Actor.HideName(InstIndex);
+	}
+};
+
 void AHIPointAndNameActor::UpdateTransform()
 {
 	if (HIPoint->GetStaticMesh() && HIPoint->IsVisible())
 	{
 		if (bSetBoundSize && HIPoint->GetInstanceCount() > 0)
 		{
-			FVector ControllerLocation = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraLocation();
-			AActor* FriController = GetWorld()->GetFirstPlayerController();
+			const FPointViewState* View = UInstancedPointSubsystem::FindViewState(this);
+			if (!View)
+			{
+				return;
+			}
+			ScreenProjector = View->Projector;
 
-			FVector2D ViewSize;
-			GetWorld()->GetGameViewport()->GetViewportSize(ViewSize);
+			FRotator NewRotator = FPointBillboardUpdate::MakeBillboardRotator(bLockZ, View->ControllerForward, View->ControllerUp);
+			const float CollapsedScale = 0.001f;
 
-			//UWidgetComponent* NewActorComp;
+			const bool bCanHideWithCustomData = bHideWithCustomData && FPointMaterialBillboard::MaterialsReadVisibility(*HIPoint);
+			if (bHideWithCustomData && !bCanHideWithCustomData && !bWarnedMissingVisibility)
+			{
+				//Writing the flag alone would leave hidden instances on screen, collapse the scale instead
+				UE_LOG(LogTemp, Warning, TEXT("%s: bHideWithCustomData needs materials using InstancedPointVisibility.ush with an IP_CustomDataVisibility parameter, hiding by scale instead"), *GetName());
+				bWarnedMissingVisibility = true;
+			}
+			if (bCanHideWithCustomData != bHidingWithCustomData)
+			{
+				bHidingWithCustomData = bCanHideWithCustomData;
+				LocationCache.MarkDirty();
+			}
 
-			for (int32 i = 0; i < HIPoint->GetInstanceCount(); i++)
+			if (bHidingWithCustomData && HIPoint->NumCustomDataFloats <= VisibilityCustomDataIndex)
 			{
-				FTransform InstanceTransform;
-				HIPoint->GetInstanceTransform(i, InstanceTransform, true);
-				FVector InstanceLocation = InstanceTransform.GetLocation();
+				HIPoint->SetNumCustomDataFloats(VisibilityCustomDataIndex + 1);
+				LocationCache.MarkDirty();
+			}
 
-				float ScreenDistance = (InstanceLocation - ControllerLocation).Size();
+			if (LocationCache.IsDirty() || LocationCache.Num() != HIPoint->GetInstanceCount())
+			{
+				//Instances hidden with custom data read as collapsed
+				LocationCache.Rebuild(*HIPoint, bHidingWithCustomData ? VisibilityCustomDataIndex : INDEX_NONE, CollapsedScale);
+
+				//Instance indices may have moved, names are bound again
+				HideAllNames();
 
-				if (bCulling)
+				BillboardCandidates.SetNumUninitialized(LocationCache.Num());
+				for (int32 i = 0; i < BillboardCandidates.Num(); i++)
 				{
-					//жǷʾͼ
-					if (ScreenDistance < PatternCullingDistance)
-					{
-						FVector ControllerUp = FriController->GetActorUpVector();
-						FVector ControllerForward = FriController->GetActorForwardVector() * (bLockZ ? FVector(-1.0, -1.0, 0.0) : FVector(-1.0, -1.0, -1.0));
-						ControllerForward.Normalize(0.0001);
-
-						FVector2D ScreenLocationA;
-						FVector2D ScreenLocationB;
-						GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation, ScreenLocationA, true);
-						GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation + (ControllerUp * BoundSize), ScreenLocationB, true);
-
-						FVector NewScale;
-						if (ScreenLocationA.X > 0 && ScreenLocationA.X < ViewSize.X && ScreenLocationA.Y > 0 && ScreenLocationA.Y < ViewSize.Y && ScreenLocationB.X > 0 && ScreenLocationB.X < ViewSize.X && ScreenLocationB.Y > 0 && ScreenLocationB.Y < ViewSize.Y)
-						{
-							NewScale = FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
-						}
-						else
-						{
-							NewScale = InstanceTransform.GetScale3D();
-						}
-						//FVector NewScale = FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
-
-						FRotator NewRotator = FRotationMatrix::MakeFromYZ(ControllerForward, (bLockZ ? FVector(0.0, 0.0, 1.0) : ControllerUp)).Rotator();
-						FTransform NewTransform = FTransform(NewRotator, InstanceLocation, NewScale);
-
-						if (NewTransform.ContainsNaN())
-						{
-							UE_LOG(LogTemp, Warning, TEXT("Instance transform ContainsNaN"));
-						}
-						HIPoint->UpdateInstanceTransform(i, NewTransform, true, true);
-
-						//жǷʾName
-						if (ScreenDistance < NameCullingDistance)
-						{
-							if (!ShowNameMap.Contains(i))
-							{
-								if (NameWidgetClass)
-								{
-									FString ComponentName = TEXT("UI_") + FString::FromInt(i);
-									UWidgetComponent* NewActorComp = NewObject<UWidgetComponent>(this, *ComponentName);
-									NewActorComp->SetWidgetSpace(EWidgetSpace::Screen);
-									NewActorComp->SetWidgetClass(NameWidgetClass);
-									NewActorComp->SetDrawSize(NameDrawSize);
-									NewActorComp->SetPivot(NamePivot);
-									NewActorComp->SetWorldLocation(InstanceLocation);
-									//NameMap.Find(i);
-									NewActorComp->RegisterComponent();
-									ShowNameMap.Emplace(i, NewActorComp);
-								}
-							}
-						}
-						else
-						{
-							if (ShowNameMap.Contains(i))
-							{
-								ShowNameMap[i]->DestroyComponent();
-								ShowNameMap.Remove(i);
-							}
-						}
-					}
-					else
-					{
-						if (InstanceTransform.GetScale3D() == FVector(0.0, 0.0, 0.0))
-						{
-							continue;
-						}
-						//ScaleΪ0ģͼ
-						FTransform NewTransform = FTransform(FRotator(1.0, 1.0, 1.0), InstanceLocation, FVector(0.001, 0.001, 0.001));
-						if (NewTransform.ContainsNaN())
-						{
-							UE_LOG(LogTemp, Warning, TEXT("Instance transform ContainsNaN"));
-						}
-						HIPoint->UpdateInstanceTransform(i, NewTransform, true, true);
-					}
+					BillboardCandidates[i] = i;
 				}
-				else
-				{
-					FVector ControllerUp = FriController->GetActorUpVector();
-					FVector ControllerForward = FriController->GetActorForwardVector() * (bLockZ ? FVector(-1.0, -1.0, 0.0) : FVector(-1.0, -1.0, -1.0));
-					ControllerForward.Normalize(0.0001);
+			}
 
-					FVector2D ScreenLocationA;
-					FVector2D ScreenLocationB;
-					GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation, ScreenLocationA, true);
-					GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation + (ControllerUp * BoundSize), ScreenLocationB, true);
+			FPointBillboardParams Params;
+			Params.CameraLocation = View->CameraLocation;
+			Params.UpOffset = View->ControllerUp * BoundSize;
+			Params.ScreenSize = ScreenSize;
+			Params.PatternCullingDistance = PatternCullingDistance;
+			Params.MinScale = CollapsedScale;
+			Params.bCulling = bCulling;
 
-					FVector NewScale = FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
-					FRotator NewRotator = FRotationMatrix::MakeFromYZ(ControllerForward, (bLockZ ? FVector(0.0, 0.0, 1.0) : ControllerUp)).Rotator();
-					FTransform NewTransform = FTransform(NewRotator, InstanceLocation, NewScale);
+			const int32 NumChunks = FPointBillboardUpdate::GetNumChunks(BillboardCandidates.Num(), true);
+			FPointBillboardUpdate::Compute(Params, ScreenProjector, LocationCache, BillboardCandidates, NumChunks, BillboardScratch, BillboardOutput);
 
-					HIPoint->UpdateInstanceTransform(i, NewTransform, true, true);
-				}
+			//Names follow culling, without it none are shown
+			if (!bCulling)
+			{
+				HideAllNames();
+			}
+
+			//Our own commits keep the instance locations
+			UHIPointMeshComponent* PointMesh = Cast<UHIPointMeshComponent>(HIPoint);
+			bool bUnusedCommitFlag = false;
+			TGuardValue<bool> CommitGuard(PointMesh ? PointMesh->bCommittingInstanceTransforms : bUnusedCommitFlag, true);
+
+			const EPointNameEmit NameEmit = bCulling ? EPointNameEmit::ShownAndCollapsed : EPointNameEmit::None;
+			if (bHidingWithCustomData)
+			{
+				THIPointNameApplySink<true> Sink(*this, NewRotator, CollapsedScale);
+				FPointBillboardUpdate::Apply(Params, NameEmit, LocationCache, BillboardCandidates, BillboardOutput, Sink);
+			}
+			else
+			{
+				THIPointNameApplySink<false> Sink(*this, NewRotator, CollapsedScale);
+				FPointBillboardUpdate::Apply(Params, NameEmit, LocationCache, BillboardCandidates, BillboardOutput, Sink);
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+void AHIPointAndNameActor::InvalidateLocationCache()
+{
+	LocationCache.MarkDirty();
+}
+
+UWidgetComponent* AHIPointAndNameActor::AcquireNameWidget()
+{
+	if (FreeNameWidgets.Num() > 0)
+	{
+		INC_DWORD_STAT(STAT_NameWidgetPoolHits);
+		return FreeNameWidgets.Pop(false);
+	}
+
+	if (!NameWidgetClass)
+	{
+		return nullptr;
+	}
+	if (NameWidgetPoolMaxSize > 0 && NumNameWidgets >= NameWidgetPoolMaxSize)
+	{
+		//Every widget is showing a name, this one goes without
+		INC_DWORD_STAT(STAT_NameWidgetPoolExhausted);
+		return nullptr;
+	}
+
+	INC_DWORD_STAT(STAT_NameWidgetPoolMisses);
+	return CreateNameWidget();
+}
+
+UWidgetComponent* AHIPointAndNameActor::CreateNameWidget()
+{
+	UWidgetComponent* NewActorComp = NewObject<UWidgetComponent>(this);
+	NewActorComp->SetWidgetSpace(EWidgetSpace::Screen);
+	NewActorComp->SetWidgetClass(NameWidgetClass);
+	NewActorComp->SetDrawSize(NameDrawSize);
+	NewActorComp->SetPivot(NamePivot);
+	NewActorComp->RegisterComponent();
+
+	NumNameWidgets++;
+	INC_DWORD_STAT(STAT_NameWidgetsLive);
+	return NewActorComp;
+}
+
+void AHIPointAndNameActor::ReleaseNameWidget(UWidgetComponent* Widget)
+{
+	if (Widget)
+	{
+		Widget->SetVisibility(false);
+		FreeNameWidgets.Add(Widget);
+	}
+}
+
+void AHIPointAndNameActor::ShowName(int32 InstIndex, const FVector& InstanceLocation)
+{
+	if (ShowNameMap.Contains(InstIndex))
+	{
+		return;
+	}
+
+	UWidgetComponent* Widget = AcquireNameWidget();
+	if (!Widget)
+	{
+		return;
+	}
+
+	Widget->SetWorldLocation(InstanceLocation);
+	Widget->SetVisibility(true);
+
+	//The user widget is created when the component registers, rebind it to this point
+	UUserWidget* UserWidget = Widget->GetUserWidgetObject();
+	if (UserWidget && UserWidget->GetClass()->ImplementsInterface(UPointNameWidget::StaticClass()))
+	{
+		const FString* Name = NameMap.Find(InstIndex);
+		IPointNameWidget::Execute_SetPointName(UserWidget, Name ? *Name : FString(), InstIndex);
+	}
+	ShowNameMap.Emplace(InstIndex, Widget);
+}
+
+void AHIPointAndNameActor::HideName(int32 InstIndex)
+{
+	UWidgetComponent* Widget = nullptr;
+	if (ShowNameMap.RemoveAndCopyValue(InstIndex, Widget))
+	{
+		ReleaseNameWidget(Widget);
+	}
+}
+
+void AHIPointAndNameActor::HideAllNames()
+{
+	for (const TPair<int32, UWidgetComponent*>& Shown : ShowNameMap)
+	{
+		ReleaseNameWidget(Shown.Value);
+	}
+	ShowNameMap.Reset();
+}
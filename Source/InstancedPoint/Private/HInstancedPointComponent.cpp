@@ -2,181 +2,1354 @@
 
 
 #include "HInstancedPointComponent.h"
+#include "InstancedPoint.h"
+#include "InstancedPointSubsystem.h"
+#include "PointInstanceUploadBuffer.h"
+#include "PointMaterialBillboard.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+
+DECLARE_CYCLE_STAT(TEXT("HIPoint UpdateTransform"), STAT_HIPointUpdateTransform, STATGROUP_InstancedPoint);
+DECLARE_CYCLE_STAT(TEXT("HIPoint Async Compute"), STAT_HIPointAsyncCompute, STATGROUP_InstancedPoint);
+DECLARE_CYCLE_STAT(TEXT("HIPoint Async Wait"), STAT_HIPointAsyncWait, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Render State Updates"), STAT_HIPointRenderStateUpdates, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Instances Updated"), STAT_HIPointInstancesUpdated, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Visibility Updated"), STAT_HIPointVisibilityUpdated, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Name Changes"), STAT_HIPointNameChanges, STATGROUP_InstancedPoint);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("HIPoint Instances Shown"), STAT_HIPointInstancesShown, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Billboard Candidates"), STAT_HIPointBillboardCandidates, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Clusters Visited"), STAT_HIPointClustersVisited, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Time Sliced Instances"), STAT_HIPointTimeSlicedInstances, STATGROUP_InstancedPoint);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("HIPoint Tree Rebuilds Per Minute"), STAT_HIPointTreeRebuildsPerMinute, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Direct Instance Uploads"), STAT_HIPointDirectInstanceUploads, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("HIPoint Direct Upload Ranges"), STAT_HIPointDirectUploadRanges, STATGROUP_InstancedPoint);
+
+static TAutoConsoleVariable<int32> CVarAsyncBillboardUpdate(
+	TEXT("ip.AsyncBillboardUpdate"),
+	1,
+	TEXT("Let point components with bAsyncUpdate compute their billboards on a task.\n")
+	TEXT(" 0: always synchronous\n")
+	TEXT(" 1: async for components that allow it (default)"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarDirectInstanceUpdate(
+	TEXT("ip.DirectInstanceUpdate"),
+	1,
+	TEXT("Let point components send custom data visibility flags, and billboard transforms with bDirectInstanceUpdate, to the render instance buffer.\n")
+	TEXT(" 0: always through the engine instance updates and a render state update\n")
+	TEXT(" 1: direct when the render data allows it (default)"),
+	ECVF_Default);
 
 UHInstancedPointComponent::UHInstancedPointComponent(const FObjectInitializer& PCIP)
 	:Super(PCIP)
 {
 	PrimaryComponentTick.bCanEverTick = true;
+
+	//Async results are applied late in the same frame, after gameplay and animation
+	CommitTickFunction.TickGroup = TG_PostUpdateWork;
+	CommitTickFunction.bCanEverTick = true;
+	CommitTickFunction.bStartWithTickEnabled = true;
 }
 
 float UHInstancedPointComponent::SetBoundsSize()
 {
 	FVector MeshExtent = GetStaticMesh()->GetBounds().BoxExtent;
 	BoundSize = FMath::Max<float>(MeshExtent.X, MeshExtent.Y);
+	BoundSize = FMath::Max<float>(BoundSize, MeshExtent.Z);
 	bSetBoundSize = true;
-	return BoundSize = FMath::Max<float>(BoundSize, MeshExtent.Z);
+	ViewGate.ForceUpdate();
+	if (bMaterialBillboard)
+	{
+		//BoundSize is in the custom data
+		InvalidateLocationCache();
+	}
+	return BoundSize;
 }
 
 void UHInstancedPointComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	UpdateTransform();
+	if (ShouldUpdateThisFrame())
+	{
+		UpdateTransform();
+	}
 	//UE_LOG(LogTemp, Warning, TEXT("IPC"));
 
 }
 
+bool UHInstancedPointComponent::ShouldUpdateThisFrame()
+{
+	if (IsBulkLoading())
+	{
+		return false;
+	}
+
+	if (bMaterialBillboard && MaxBillboardScale <= 0.0f)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: bMaterialBillboard needs a positive MaxBillboardScale, billboarding on the CPU"), *GetPathName());
+		SetMaterialBillboard(false);
+	}
+
+	if (bMaterialBillboard)
+	{
+		//The material follows the camera, only changed instances need writing
+		if (bMaterialBillboardDirty && GetStaticMesh() && bSetBoundSize)
+		{
+			ApplyMaterialBillboard();
+		}
+		if (!bMaterialBillboardDirty && !bCentralUpdate)
+		{
+			SetComponentTickEnabled(false);
+		}
+		return false;
+	}
+
+	if (SelectedInstanceIndex != GatedSelectedInstanceIndex)
+	{
+		GatedSelectedInstanceIndex = SelectedInstanceIndex;
+		ViewGate.ForceUpdate();
+
+		//Restart so the selected instance goes first
+		AbandonTimeSlicedPass();
+	}
+
+	//Nothing depends on time, a still camera leaves every transform as it is.
+	//A time sliced pass keeps going until every instance got its turn.
+	const FPointViewState* View = UInstancedPointSubsystem::FindViewState(this);
+	return CanUpdateTransform() && (IsTimeSlicedPassRunning() || !View || ViewGate.ShouldUpdate(View->Camera, CameraUpdateTolerance));
+}
+
 void UHInstancedPointComponent::UpdateTransform()
 {
+	RunUpdate(false);
+}
+
+bool UHInstancedPointComponent::UpdateTransformDeferred()
+{
+	return RunUpdate(true);
+}
+
+void UHInstancedPointComponent::ComputeDeferredRange(int32 Start, int32 End, FPointBillboardChunkScratch& Scratch)
+{
+	FPointBillboardUpdate::ComputeRange(DeferredParams, ScreenProjector, LocationCache, BillboardCandidates, Start, End, Scratch, BillboardOutput);
+}
+
+void UHInstancedPointComponent::FinishDeferredUpdate()
+{
+	if (!bDeferredComputePending)
+	{
+		return;
+	}
+	bDeferredComputePending = false;
+
+	SCOPE_CYCLE_COUNTER(STAT_HIPointUpdateTransform);
+	TGuardValue<bool> QueueGuard(bQueueingInstanceTransforms, true);
+	ActiveInstances.Reset();
+	ApplyBillboardOutput(DeferredParams, ActiveInstances);
+	FlushInstanceTransforms();
+	BroadcastNameChanges();
+}
+
+bool UHInstancedPointComponent::RunUpdate(bool bDeferCompute)
+{
+	SCOPE_CYCLE_COUNTER(STAT_HIPointUpdateTransform);
+
+	//An update still in flight is applied first, the new one replaces its candidates
+	CommitAsyncBillboardUpdate();
+
+	RenderStateUpdatesLastTick = 0;
+	TrackClusterTreeChanges();
+
+	TGuardValue<bool> QueueGuard(bQueueingInstanceTransforms, true);
+
 	if (GetStaticMesh() && IsVisible())
 	{
 		if (bSetBoundSize && GetInstanceCount() > 0)
 		{
-			FVector ControllerLocation = GetWorld()->GetFirstPlayerController()->PlayerCameraManager->GetCameraLocation();
-			AActor* FriController = GetWorld()->GetFirstPlayerController();
+			//View projection is built once per frame for every component, every in-range instance is projected in one batch
+			const FPointViewState* View = UInstancedPointSubsystem::FindViewState(this);
+			if (!View)
+			{
+				return false;
+			}
+			ScreenProjector = View->Projector;
+
+			FVector ControllerLocation = View->CameraLocation;
+			FVector ControllerUp = View->ControllerUp;
+			BillboardRotator = FPointBillboardUpdate::MakeBillboardRotator(bLockZ, View->ControllerForward, ControllerUp);
+
+			const bool bCanHideWithCustomData = CanHideWithCustomData();
+			if (bCanHideWithCustomData != bHidingWithCustomData)
+			{
+				//Which instances count as hidden changed, read it again
+				bHidingWithCustomData = bCanHideWithCustomData;
+				LocationCache.MarkDirty();
+			}
+			if (bHidingWithCustomData && NumCustomDataFloats <= VisibilityCustomDataIndex)
+			{
+				//Every instance starts hidden, the update below shows the ones in range
+				SetNumCustomDataFloats(VisibilityCustomDataIndex + 1);
+				LocationCache.MarkDirty();
+			}
+
+			if (LocationCache.IsDirty() || LocationCache.Num() != GetInstanceCount())
+			{
+				LocationCache.Rebuild(*this, bHidingWithCustomData ? VisibilityCustomDataIndex : INDEX_NONE, GetMinScale3D().X);
+				RebuildSpatialIndex();
+				bStableTreeDirty = true;
+				InstanceUploadBuffer.Reset(0);
+			}
+			else if (SpatialGridPatternDistance != PatternCullingDistance)
+			{
+				RebuildSpatialIndex();
+			}
+			UpdateStableClusterTree();
 
-			FVector2D ViewSize;
-			GetWorld()->GetGameViewport()->GetViewportSize(ViewSize);
+			PendingIndices.Reset();
+			PendingTransforms.Reset();
 
-			for (int32 i = 0; i < GetInstanceCount(); i++)
+			FPointBillboardParams Params;
+			Params.CameraLocation = ControllerLocation;
+			Params.UpOffset = ControllerUp * BoundSize;
+			Params.ScreenSize = ScreenSize;
+			Params.PatternCullingDistance = PatternCullingDistance;
+			Params.MinScale = GetMinScale3D().X;
+			Params.MaxScale = MaxBillboardScale;
+			Params.SelectedInstanceIndex = SelectedInstanceIndex;
+			Params.bCulling = bCulling;
+
+			if (bTimeSlicedUpdate)
+			{
+				UpdateTimeSliced(Params, View->CameraForward);
+			}
+			else
 			{
-				FTransform InstanceTransform;
-				GetInstanceTransform(i, InstanceTransform, true);
-				FVector InstanceLocation = InstanceTransform.GetLocation();
+				AbandonTimeSlicedPass();
 
-				float ScreenDistance = (InstanceLocation - ControllerLocation).Size();
+				GatherBillboardCandidates(Params);
+				Params.CandidateFrustum = CandidateFrustum;
 
-				if (i == SelectedInstanceIndex)
+				if (ShouldUpdateAsync())
 				{
-					//FTransform NewTransform = FTransform(FRotator(0.01, 0.01, 0.01), InstanceLocation, FVector(0.01, 0.01, 0.01));
-					FTransform NewTransform = GetMinTransform(InstanceLocation);
-					if (NewTransform.ContainsNaN())
-					{
-						UE_LOG(LogTemp, Warning, TEXT("Instance transform ContainsNaN"));
-					}
-					UpdateInstanceTransform(i, NewTransform, true, true);
-
-					UpdateName(ScreenDistance, i, InstanceLocation);
-					
-					if (ScreenDistance < PatternCullingDistance)
-					{
-						//SelectPatternCulling = false;
-					}
-					else
-					{
-						//SelectPatternCulling = true;
-						OnSelectPatternCulling.Broadcast();
-					}
-
-					continue;
+					LaunchAsyncBillboardUpdate(Params);
 				}
-
-				if (bCulling)
+				else if (bDeferCompute)
 				{
-					//жǷʾͼ
-					if (ScreenDistance < PatternCullingDistance)
-					{
-						UpdateType(i, InstanceLocation, FriController, ViewSize, InstanceTransform);
-
-						//жǷʾName
-						UpdateName(ScreenDistance, i, InstanceLocation);
-					}
-					else
-					{
-						if (InstanceTransform.GetScale3D() == GetMinScale3D())
-						{
-							continue;
-						}
-						//ScaleΪ0ģͼ
-						FTransform NewTransform = GetMinTransform(InstanceLocation);
-						if (NewTransform.ContainsNaN())
-						{
-							UE_LOG(LogTemp, Warning, TEXT("Instance transform ContainsNaN"));
-						}
-						UpdateInstanceTransform(i, NewTransform, true, true);
-					}
+					//The caller computes BillboardOutput, then calls FinishDeferredUpdate
+					DeferredParams = Params;
+					BillboardOutput.SetNum(BillboardCandidates.Num());
+					bDeferredComputePending = true;
+					return true;
 				}
 				else
 				{
-					UpdateType(i, InstanceLocation, FriController, ViewSize, InstanceTransform);
+					ActiveInstances.Reset();
+					CommitBillboardCandidates(Params, ActiveInstances);
 				}
 			}
+
+			FlushInstanceTransforms();
+			BroadcastNameChanges();
 		}
 	}
+
+	return false;
 }
 
-void UHInstancedPointComponent::SetCulling(float PatternDis, float NameDis)
+void UHInstancedPointComponent::CommitBillboardCandidates(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances)
 {
-	PatternCullingDistance = PatternDis;
-	NameCullingDistance = NameDis;
+	//Per instance work may run in parallel, everything below is committed in index order
+	const int32 NumChunks = FPointBillboardUpdate::GetNumChunks(BillboardCandidates.Num(), bParallelUpdate);
+	FPointBillboardUpdate::Compute(Params, ScreenProjector, LocationCache, BillboardCandidates, NumChunks, BillboardScratch, BillboardOutput);
+
+	ApplyBillboardOutput(Params, OutActiveInstances);
 }
 
-void UHInstancedPointComponent::SetLockZ(bool Lock)
+/**
+ * Writes of the apply pass. With bVisibilityCustomData hidden instances keep their
+ * transform and only the custom data flag changes, picked once per update.
+ */
+template<bool bVisibilityCustomData>
+struct THIPointApplySink
 {
-	bLockZ = Lock;
+	UHInstancedPointComponent& Component;
+	const FPointBillboardParams& Params;
+	TArray<int32>& ActiveInstances;
+
+	THIPointApplySink(UHInstancedPointComponent& InComponent, const FPointBillboardParams& InParams, TArray<int32>& InActiveInstances)
+		: Component(InComponent)
+		, Params(InParams)
+		, ActiveInstances(InActiveInstances)
+	{
+	}
+
+	FORCEINLINE void Hide(int32 InstIndex, const FTransform& CollapsedTransform)
+	{
+		if (!bVisibilityCustomData)
+		{
+			Component.QueueInstanceTransform(InstIndex, CollapsedTransform);
+		}
+		else if (Component.LocationCache.AppliedScale[InstIndex] != Params.MinScale)
+		{
+			//Hidden instances keep their last transform, the material drops them
+			Component.QueueInstanceVisibility(InstIndex, false);
+			Component.SetAppliedScale(InstIndex, Params.MinScale);
+		}
+	}
+
+	FORCEINLINE void Collapse(int32 InstIndex, const FVector& Location)
+	{
+		//ScaleΪ0ģͼ
+		Hide(InstIndex, Component.GetMinTransform(Location));
+	}
+
+	FORCEINLINE void Billboard(int32 InstIndex, const FVector& Location, float Scale)
+	{
+		//Shown again, the transform was left as it was when hidden
+		const bool bWasHidden = bVisibilityCustomData && Component.LocationCache.AppliedScale[InstIndex] == Params.MinScale;
+		Component.QueueInstanceTransform(InstIndex, FTransform(Component.BillboardRotator, Location, FVector(Scale)));
+		if (bWasHidden)
+		{
+			Component.QueueInstanceVisibility(InstIndex, true);
+		}
+		ActiveInstances.Add(InstIndex);
+	}
+
+	FORCEINLINE void OffScreen(int32 InstIndex, const FVector& Location)
+	{
+		Hide(InstIndex, FTransform(Component.BillboardRotator, Location, FVector(Params.MinScale)));
+	}
+
+	FORCEINLINE void Select(int32 InstIndex, const FVector& Location, float Distance)
+	{
+		Hide(InstIndex, Component.GetMinTransform(Location));
+		Component.UpdateName(Distance, InstIndex, Location);
+		if (Distance >= Component.PatternCullingDistance)
+		{
+			Component.OnSelectPatternCulling.Broadcast();
+		}
+	}
+
+	FORCEINLINE void Name(int32 InstIndex, const FVector& Location, float Distance)
+	{
+		//жǷʾName
+		Component.UpdateName(Distance, InstIndex, Location);
+	}
+
+	FORCEINLINE void HideName(int32 InstIndex)
+	{
+		//Names of collapsed instances are left as they are
+	}
+};
+
+void UHInstancedPointComponent::ApplyBillboardOutput(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances)
+{
+	//Apply runs under the queue guard, the hiding mode is picked once per update
+	if (bHidingWithCustomData && bQueueingInstanceTransforms)
+	{
+		ApplyBillboardOutputKernel<true>(Params, OutActiveInstances);
+	}
+	else
+	{
+		ApplyBillboardOutputKernel<false>(Params, OutActiveInstances);
+	}
 }
 
-void UHInstancedPointComponent::UpdateName(float ScrDis, int32 InstIndex, FVector InstanceLocation)
+template<bool bVisibilityCustomData>
+void UHInstancedPointComponent::ApplyBillboardOutputKernel(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances)
+{
+	//Names follow culling
+	THIPointApplySink<bVisibilityCustomData> Sink(*this, Params, OutActiveInstances);
+	FPointBillboardUpdate::Apply(Params, Params.bCulling ? EPointNameEmit::Shown : EPointNameEmit::None, LocationCache, BillboardCandidates, BillboardOutput, Sink);
+}
+
+bool UHInstancedPointComponent::ShouldUpdateAsync() const
+{
+	return bAsyncUpdate && CVarAsyncBillboardUpdate.GetValueOnGameThread() != 0 && FApp::ShouldUseThreadingForPerformance() && CommitTickFunction.IsTickFunctionRegistered();
+}
+
+void UHInstancedPointComponent::LaunchAsyncBillboardUpdate(const FPointBillboardParams& Params)
+{
+	//The task owns the projector, location cache, candidates, scratch and output until the commit tick waits for it
+	AsyncParams = Params;
+	const int32 NumChunks = FPointBillboardUpdate::GetNumChunks(BillboardCandidates.Num(), bParallelUpdate);
+	AsyncBillboardTask = FFunctionGraphTask::CreateAndDispatchWhenReady([this, NumChunks]()
+	{
+		SCOPE_CYCLE_COUNTER(STAT_HIPointAsyncCompute);
+		FPointBillboardUpdate::Compute(AsyncParams, ScreenProjector, LocationCache, BillboardCandidates, NumChunks, BillboardScratch, BillboardOutput);
+	}, TStatId(), nullptr, ENamedThreads::AnyHiPriThreadNormalTask);
+}
+
+void UHInstancedPointComponent::WaitForAsyncBillboardUpdate()
+{
+	if (AsyncBillboardTask.IsValid())
+	{
+		SCOPE_CYCLE_COUNTER(STAT_HIPointAsyncWait);
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(AsyncBillboardTask, ENamedThreads::GameThread);
+		AsyncBillboardTask = nullptr;
+	}
+}
+
+void UHInstancedPointComponent::CommitAsyncBillboardUpdate()
+{
+	if (!AsyncBillboardTask.IsValid())
+	{
+		return;
+	}
+
+	WaitForAsyncBillboardUpdate();
+
+	//Instances changed while the task ran, its results no longer match them
+	if (LocationCache.IsDirty() || LocationCache.Num() != GetInstanceCount())
+	{
+		ViewGate.ForceUpdate();
+		return;
+	}
+
+	TGuardValue<bool> QueueGuard(bQueueingInstanceTransforms, true);
+	ActiveInstances.Reset();
+	ApplyBillboardOutput(AsyncParams, ActiveInstances);
+	FlushInstanceTransforms();
+	BroadcastNameChanges();
+}
+
+void UHInstancedPointComponent::RegisterComponentTickFunctions(bool bRegister)
 {
-	FString TypeName = Type;
-	if (ScrDis < NameCullingDistance)
+	Super::RegisterComponentTickFunctions(bRegister);
+
+	if (bRegister)
 	{
-		if (!ShowNameMap.Contains(InstIndex))
+		//The subsystem updates us, registering the tick function turned it back on
+		if (bCentralUpdate)
+		{
+			SetComponentTickEnabled(false);
+		}
+
+		if (SetupActorComponentTickFunction(&CommitTickFunction))
 		{
-			ShowNameMap.Add(InstIndex, InstanceLocation);
-			EOnCullingName.Broadcast(TypeName, InstIndex, InstanceLocation, false);
+			CommitTickFunction.Target = this;
+			CommitTickFunction.AddPrerequisite(this, PrimaryComponentTick);
 		}
 	}
-	else
+	else if (CommitTickFunction.IsTickFunctionRegistered())
+	{
+		CommitTickFunction.UnRegisterTickFunction();
+	}
+}
+
+void UHInstancedPointComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	UWorld* World = GetWorld();
+	UInstancedPointSubsystem* Subsystem = World && World->IsGameWorld() ? World->GetSubsystem<UInstancedPointSubsystem>() : nullptr;
+	bCentralUpdate = Subsystem && Subsystem->RegisterPointComponent(this);
+	if (bCentralUpdate)
+	{
+		SetComponentTickEnabled(false);
+	}
+}
+
+void UHInstancedPointComponent::OnUnregister()
+{
+	//The task reads this component, it cannot outlive it
+	WaitForAsyncBillboardUpdate();
+
+	if (bCentralUpdate)
 	{
-		if (ShowNameMap.Contains(InstIndex))
+		if (UInstancedPointSubsystem* Subsystem = GetWorld() ? GetWorld()->GetSubsystem<UInstancedPointSubsystem>() : nullptr)
 		{
-			ShowNameMap.Remove(InstIndex);
-			EOnCullingName.Broadcast(TypeName, InstIndex, InstanceLocation, true);
+			Subsystem->UnregisterPointComponent(this);
 		}
+		bCentralUpdate = false;
+	}
+
+	NumShownInstances = 0;
+	ReportShownInstances();
+
+	TreeChangeTimes.Reset();
+	DEC_DWORD_STAT_BY(STAT_HIPointTreeRebuildsPerMinute, ReportedTreeChanges);
+	ReportedTreeChanges = 0;
+
+	Super::OnUnregister();
+}
+
+void UHInstancedPointComponent::BeginDestroy()
+{
+	WaitForAsyncBillboardUpdate();
+
+	Super::BeginDestroy();
+}
+
+void FHInstancedPointCommitTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Target && !Target->IsPendingKill())
+	{
+		Target->CommitAsyncBillboardUpdate();
 	}
 }
 
-void UHInstancedPointComponent::UpdateType(int32 InstIndex, FVector InstanceLocation, AActor* iNFriController, FVector2D InViewSize, FTransform InInstanceTransform)
+FString FHInstancedPointCommitTickFunction::DiagnosticMessage()
+{
+	return Target ? Target->GetFullName() + TEXT("[CommitBillboard]") : TEXT("<NULL>[CommitBillboard]");
+}
+
+void UHInstancedPointComponent::UpdateTimeSliced(FPointBillboardParams& Params, const FVector& CameraForward)
 {
-	FVector ControllerUp = iNFriController->GetActorUpVector();
-	FVector ControllerForward = iNFriController->GetActorForwardVector() * (bLockZ ? FVector(-1.0, -1.0, 0.0) : FVector(-1.0, -1.0, -1.0));
-	//FVector ControllerForward = FriController->GetActorForwardVector() * FVector(-1.0, -1.0, -1.0);
-	ControllerForward.Normalize(0.01);
+	if (TimeSlicedCursor >= TimeSlicedInstances.Num())
+	{
+		BeginTimeSlicedPass(Params, CameraForward);
+	}
+
+	const int32 PassNum = TimeSlicedInstances.Num();
+	if (PassNum == 0)
+	{
+		return;
+	}
+
+	double BudgetMicroseconds = TNumericLimits<float>::Max();
+	int32 BudgetInstances = 0;
+	UInstancedPointSubsystem* Subsystem = UWorld::GetSubsystem<UInstancedPointSubsystem>(GetWorld());
+	if (Subsystem)
+	{
+		Subsystem->AcquireBillboardBudget(BudgetMicroseconds, BudgetInstances);
+	}
+
+	//Slice size from the measured cost, never below what finishes the pass in MaxRefreshFrames
+	int32 SliceNum = (int32)FMath::Min(BudgetMicroseconds / FMath::Max(TimeSlicedCostPerInstance, 0.001), (double)PassNum);
+	if (BudgetInstances > 0)
+	{
+		SliceNum = FMath::Min(SliceNum, BudgetInstances);
+	}
+	SliceNum = FMath::Max(SliceNum, FMath::DivideAndRoundUp(PassNum, FMath::Max(MaxRefreshFrames, 1)));
+	SliceNum = FMath::Clamp(SliceNum, 1, PassNum - TimeSlicedCursor);
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	BillboardCandidates.Reset();
+	BillboardCandidates.Append(TimeSlicedInstances.GetData() + TimeSlicedCursor, SliceNum);
+	BillboardCandidates.Sort();
+	TimeSlicedCursor += SliceNum;
+
+	//The camera may have moved since the pass started, every instance gets the full viewport test
+	Params.CandidateFrustum = TArrayView<const uint8>();
+	CommitBillboardCandidates(Params, TimeSlicedActiveInstances);
+
+	const double UsedMicroseconds = (FPlatformTime::Seconds() - StartTime) * 1000000.0;
+	TimeSlicedCostPerInstance = FMath::Lerp(TimeSlicedCostPerInstance, UsedMicroseconds / SliceNum, 0.25);
+	if (Subsystem)
+	{
+		Subsystem->ReleaseBillboardBudget(UsedMicroseconds, SliceNum);
+	}
+	INC_DWORD_STAT_BY(STAT_HIPointTimeSlicedInstances, SliceNum);
+
+	if (TimeSlicedCursor >= PassNum)
+	{
+		//Every instance shown during the pass was recorded, the previous set is obsolete
+		Swap(ActiveInstances, TimeSlicedActiveInstances);
+		ResetTimeSlicedPass();
+	}
+}
 
-	FVector2D ScreenLocationA;
-	FVector2D ScreenLocationB;
-	GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation, ScreenLocationA, true);
-	GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation + (ControllerUp * BoundSize), ScreenLocationB, true);
+void UHInstancedPointComponent::BeginTimeSlicedPass(const FPointBillboardParams& Params, const FVector& CameraForward)
+{
+	ResetTimeSlicedPass();
+	GatherBillboardCandidates(Params);
 
-	FVector NewScale;
-	if (ScreenLocationA.X > 0 && ScreenLocationA.X < InViewSize.X && ScreenLocationA.Y > 0 && ScreenLocationA.Y < InViewSize.Y && ScreenLocationB.X > 0 && ScreenLocationB.X < InViewSize.X && ScreenLocationB.Y > 0 && ScreenLocationB.Y < InViewSize.Y)
+	//Nearest and closest to the screen centre first, as positive floats the key bits sort like the keys
+	TArray<uint64> SortKeys;
+	SortKeys.SetNumUninitialized(BillboardCandidates.Num());
+	for (int32 k = 0; k < BillboardCandidates.Num(); k++)
 	{
-		float ScreenLen = (ScreenLocationA - ScreenLocationB).Size();
-		if (ScreenLen == 0)
+		const int32 i = BillboardCandidates[k];
+		float Priority = 0.0f;
+		if (i != SelectedInstanceIndex)
 		{
-			ScreenLen = 0.01;
+			const FVector ToInstance = LocationCache.GetLocation(i) - Params.CameraLocation;
+			const float Distance = ToInstance.Size();
+			const float CosAngle = Distance > KINDA_SMALL_NUMBER ? FVector::DotProduct(ToInstance / Distance, CameraForward) : 1.0f;
+			Priority = Distance * (2.0f - CosAngle);
 		}
-		NewScale = FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
+		uint32 PriorityBits;
+		FMemory::Memcpy(&PriorityBits, &Priority, sizeof(PriorityBits));
+		SortKeys[k] = ((uint64)PriorityBits << 32) | (uint32)i;
 	}
-	else
+	SortKeys.Sort();
+
+	TimeSlicedInstances.SetNumUninitialized(SortKeys.Num());
+	for (int32 k = 0; k < SortKeys.Num(); k++)
+	{
+		TimeSlicedInstances[k] = (int32)(SortKeys[k] & 0xffffffff);
+	}
+}
+
+void UHInstancedPointComponent::AbandonTimeSlicedPass()
+{
+	//Instances shown by the unfinished pass must still be visited by the next update
+	if (IsTimeSlicedPassRunning())
+	{
+		ActiveInstances.Append(TimeSlicedActiveInstances);
+		ResetTimeSlicedPass();
+	}
+}
+
+void UHInstancedPointComponent::ResetTimeSlicedPass()
+{
+	TimeSlicedInstances.Reset();
+	TimeSlicedActiveInstances.Reset();
+	TimeSlicedCursor = 0;
+}
+
+void UHInstancedPointComponent::RebuildSpatialIndex()
+{
+	//Cells of half the pattern distance, a culling sphere touches about 5x5 of them
+	SpatialGrid.Build(LocationCache, FMath::Max(PatternCullingDistance * 0.5, 1.0));
+	SpatialGridPatternDistance = PatternCullingDistance;
+
+	const float MinScale = GetMinScale3D().X;
+	ActiveInstances.Reset();
+	for (int32 i = 0; i < LocationCache.Num(); i++)
+	{
+		if (LocationCache.AppliedScale[i] != MinScale)
+		{
+			ActiveInstances.Add(i);
+		}
+	}
+	NumShownInstances = ActiveInstances.Num();
+	ReportShownInstances();
+
+	if (NameShownBits.Num() > LocationCache.Num())
+	{
+		NameShownBits.RemoveAt(LocationCache.Num(), NameShownBits.Num() - LocationCache.Num());
+	}
+
+	CandidateStamps.Init(0, LocationCache.Num());
+	FrustumStamps.Init(0, LocationCache.Num());
+	CandidateStamp = 0;
+
+	ClusterCuller.Invalidate();
+
+	//Instance indices of a running pass may be stale
+	ResetTimeSlicedPass();
+}
+
+void UHInstancedPointComponent::UpdateStableClusterTree()
+{
+	const bool bStable = bStableClusterTree && MaxBillboardScale > 0.0f;
+	bAutoRebuildTreeOnInstanceChanges = !bStable;
+
+	if (bStable != bStableTreeApplied)
+	{
+		bStableTreeApplied = bStable;
+		bStableTreeDirty = true;
+		if (!bStable)
+		{
+			//Back to the engine's tree, built from the current transforms
+			PaddedClusterTree = nullptr;
+			BuildTreeIfOutdated(true, true);
+			return;
+		}
+	}
+
+	if (!bStable || IsAsyncBuilding() || (!bStableTreeDirty && ClusterTreePtr.Get() == PaddedClusterTree))
+	{
+		return;
+	}
+
+	//Only when instances changed, the tree does not depend on scales or rotations once padded
+	if (bStableTreeDirty || !IsTreeFullyBuilt())
+	{
+		BuildTree();
+	}
+	if (FPointClusterCuller::PadClusterTree(*this, LocationCache, GetMinScale3D().X, MaxBillboardScale))
+	{
+		PaddedClusterTree = ClusterTreePtr.Get();
+		bStableTreeDirty = false;
+		MarkRenderStateDirty();
+	}
+}
+
+bool UHInstancedPointComponent::CanUploadInPlace() const
+{
+	return CVarDirectInstanceUpdate.GetValueOnGameThread() != 0 && FPointInstanceUploadBuffer::CanSubmit(*this);
+}
+
+bool UHInstancedPointComponent::ShouldUseDirectUpload() const
+{
+	//Only the padded tree is sure to hold the new scales without a rebuild
+	return bDirectInstanceUpdate && CanUploadInPlace() && bStableTreeApplied && PaddedClusterTree && ClusterTreePtr.Get() == PaddedClusterTree;
+}
+
+void UHInstancedPointComponent::TrackClusterTreeChanges()
+{
+	const double Now = FPlatformTime::Seconds();
+	if (ClusterTreePtr.Get() != LastClusterTree)
+	{
+		LastClusterTree = ClusterTreePtr.Get();
+		if (LastClusterTree)
+		{
+			TreeChangeTimes.Add(Now);
+		}
+	}
+
+	int32 NumExpired = 0;
+	while (NumExpired < TreeChangeTimes.Num() && Now - TreeChangeTimes[NumExpired] > 60.0)
+	{
+		NumExpired++;
+	}
+	TreeChangeTimes.RemoveAt(0, NumExpired, false);
+
+	const int32 Delta = TreeChangeTimes.Num() - ReportedTreeChanges;
+	if (Delta > 0)
+	{
+		INC_DWORD_STAT_BY(STAT_HIPointTreeRebuildsPerMinute, Delta);
+	}
+	else if (Delta < 0)
+	{
+		DEC_DWORD_STAT_BY(STAT_HIPointTreeRebuildsPerMinute, -Delta);
+	}
+	ReportedTreeChanges = TreeChangeTimes.Num();
+}
+
+void UHInstancedPointComponent::GatherBillboardCandidates(const FPointBillboardParams& Params)
+{
+	BillboardCandidates.Reset();
+	CandidateFrustum.Reset();
+
+	const int32 InstanceCount = LocationCache.Num();
+
+	//The tree projection only matches the viewport test when the view covers the whole viewport
+	const bool bUseClusterTree = ClusterCuller.Update(*this, LocationCache) && ScreenProjector.ViewRectSize.Equals(ScreenProjector.ViewportSize);
+
+	if (!bUseClusterTree && !bCulling)
+	{
+		BillboardCandidates.SetNumUninitialized(InstanceCount);
+		for (int32 i = 0; i < InstanceCount; i++)
+		{
+			BillboardCandidates[i] = i;
+		}
+		return;
+	}
+
+	//Stamps keep one bit for the frustum result
+	if (++CandidateStamp >= (1u << 31))
+	{
+		CandidateStamps.Init(0, InstanceCount);
+		FrustumStamps.Init(0, InstanceCount);
+		CandidateStamp = 1;
+	}
+
+	auto AddCandidate = [this](int32 InstIndex)
+	{
+		if (CandidateStamps[InstIndex] != CandidateStamp)
+		{
+			CandidateStamps[InstIndex] = CandidateStamp;
+			BillboardCandidates.Add(InstIndex);
+		}
+	};
+
+	if (bUseClusterTree)
+	{
+		//Only clusters on screen and in pattern range need resizing, the rest of the sphere stays collapsed
+		const double PatternRadius = bCulling ? PatternCullingDistance : TNumericLimits<float>::Max();
+		FConvexVolume Frustum;
+		ScreenProjector.GetTranslatedViewFrustum(Frustum);
+		const int32 NumNodes = ClusterCuller.ForEachVisible(Frustum, ScreenProjector.ViewOrigin, Params.CameraLocation, PatternRadius, Params.UpOffset.Size(),
+			[this, &AddCandidate](int32 InstIndex, bool bFullyInside)
+			{
+				AddCandidate(InstIndex);
+				FrustumStamps[InstIndex] = (CandidateStamp << 1) | (bFullyInside ? 1 : 0);
+			});
+		INC_DWORD_STAT_BY(STAT_HIPointClustersVisited, NumNodes);
+
+		if (bCulling)
+		{
+			//Names follow distance only, off screen instances near the camera still update theirs
+			SpatialGrid.ForEachInSphere(Params.CameraLocation, FMath::Min(NameCullingDistance, PatternCullingDistance), AddCandidate);
+			for (TConstSetBitIterator<> It(NameShownBits); It; ++It)
+			{
+				if (It.GetIndex() < InstanceCount)
+				{
+					AddCandidate(It.GetIndex());
+				}
+			}
+		}
+	}
+	else
+	{
+		//Instances inside the pattern sphere need resizing, instances shown last update may have left it.
+		//Everything else is already collapsed and stays that way.
+		SpatialGrid.ForEachInSphere(Params.CameraLocation, PatternCullingDistance, AddCandidate);
+	}
+
+	for (int32 InstIndex : ActiveInstances)
+	{
+		AddCandidate(InstIndex);
+	}
+	if (SelectedInstanceIndex >= 0 && SelectedInstanceIndex < InstanceCount)
+	{
+		AddCandidate(SelectedInstanceIndex);
+	}
+
+	BillboardCandidates.Sort();
+	INC_DWORD_STAT_BY(STAT_HIPointBillboardCandidates, BillboardCandidates.Num());
+
+	if (bUseClusterTree)
+	{
+		CandidateFrustum.SetNumUninitialized(BillboardCandidates.Num());
+		for (int32 k = 0; k < BillboardCandidates.Num(); k++)
+		{
+			const uint32 Stamp = FrustumStamps[BillboardCandidates[k]];
+			if ((Stamp >> 1) != CandidateStamp)
+			{
+				CandidateFrustum[k] = (uint8)EPointFrustumResult::Outside;
+			}
+			else
+			{
+				CandidateFrustum[k] = (uint8)((Stamp & 1) ? EPointFrustumResult::Inside : EPointFrustumResult::Intersect);
+			}
+		}
+	}
+}
+
+void UHInstancedPointComponent::QueueInstanceTransform(int32 InstIndex, const FTransform& NewTransform)
+{
+	if (!bQueueingInstanceTransforms)
+	{
+		//Called outside of UpdateTransform, commit right away
+		UpdateInstanceTransform(InstIndex, NewTransform, true, true);
+		return;
+	}
+
+	//UpdateTransform queues in ascending instance order
+	PendingIndices.Add(InstIndex);
+	PendingTransforms.Add(NewTransform);
+	SetAppliedScale(InstIndex, NewTransform.GetScale3D().X);
+}
+
+void UHInstancedPointComponent::QueueInstanceVisibility(int32 InstIndex, bool bVisible)
+{
+	if (!bQueueingInstanceTransforms)
+	{
+		SetCustomDataValue(InstIndex, VisibilityCustomDataIndex, bVisible ? 1.0f : 0.0f, true);
+		return;
+	}
+
+	PendingVisibilityIndices.Add(InstIndex);
+	PendingVisibilityValues.Add(bVisible ? 1 : 0);
+}
+
+void UHInstancedPointComponent::SetAppliedScale(int32 InstIndex, float Scale)
+{
+	const float MinScale = GetMinScale3D().X;
+	float& AppliedScale = LocationCache.AppliedScale[InstIndex];
+	NumShownInstances += (Scale != MinScale ? 1 : 0) - (AppliedScale != MinScale ? 1 : 0);
+	AppliedScale = Scale;
+}
+
+bool UHInstancedPointComponent::CanHideWithCustomData()
+{
+	if (!bHideWithCustomData)
+	{
+		return false;
+	}
+	if (FPointMaterialBillboard::MaterialsReadVisibility(*this))
+	{
+		return true;
+	}
+	//Writing the flag alone would leave hidden instances on screen, collapse the scale instead
+	if (!bWarnedMissingVisibility)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: bHideWithCustomData needs materials using InstancedPointVisibility.ush with an IP_CustomDataVisibility parameter, hiding by scale instead"), *GetPathName());
+		bWarnedMissingVisibility = true;
+	}
+	return false;
+}
+
+void UHInstancedPointComponent::ReportShownInstances()
+{
+	const int32 Delta = NumShownInstances - ReportedShownInstances;
+	if (Delta > 0)
+	{
+		INC_DWORD_STAT_BY(STAT_HIPointInstancesShown, Delta);
+	}
+	else if (Delta < 0)
+	{
+		DEC_DWORD_STAT_BY(STAT_HIPointInstancesShown, -Delta);
+	}
+	ReportedShownInstances = NumShownInstances;
+}
+
+void UHInstancedPointComponent::FlushInstanceTransforms()
+{
+	const int32 NumPending = PendingIndices.Num();
+	const int32 NumVisibility = PendingVisibilityIndices.Num();
+	ReportShownInstances();
+	if (NumPending == 0 && NumVisibility == 0)
+	{
+		return;
+	}
+
+	TGuardValue<bool> CommitGuard(bCommittingInstanceTransforms, true);
+
+	//Direct uploads do not touch the render state. Visibility flags never move the bounds, they go
+	//in place with any tree unless the transforms take the engine path and mark it dirty anyway
+	const bool bDirectUpload = NumPending > 0 && ShouldUseDirectUpload();
+	const bool bDirectVisibility = NumPending == 0 ? CanUploadInPlace() : bDirectUpload;
+	INC_DWORD_STAT_BY(STAT_HIPointVisibilityUpdated, NumVisibility);
+
+	if (bDirectUpload || bDirectVisibility)
+	{
+		if (InstanceUploadBuffer.Num() != GetInstanceCount())
+		{
+			InstanceUploadBuffer.Reset(GetInstanceCount());
+		}
+		for (int32 v = 0; v < NumVisibility; v++)
+		{
+			InstanceUploadBuffer.StageCustomData(PendingVisibilityIndices[v], VisibilityCustomDataIndex, PendingVisibilityValues[v]);
+		}
+		for (int32 p = 0; p < NumPending; p++)
+		{
+			InstanceUploadBuffer.Stage(PendingIndices[p], PendingTransforms[p]);
+		}
+		const int32 NumSent = InstanceUploadBuffer.Submit(*this);
+
+		INC_DWORD_STAT_BY(STAT_HIPointDirectInstanceUploads, NumSent);
+		INC_DWORD_STAT_BY(STAT_HIPointDirectUploadRanges, InstanceUploadBuffer.GetSubmittedRanges().Num());
+		INC_DWORD_STAT_BY(STAT_HIPointInstancesUpdated, NumPending);
+
+		PendingVisibilityIndices.Reset();
+		PendingVisibilityValues.Reset();
+		PendingIndices.Reset();
+		PendingTransforms.Reset();
+		return;
+	}
+
+	//Visibility flags first, the render state is marked dirty once by whichever write comes last
+	for (int32 v = 0; v < NumVisibility; v++)
+	{
+		const bool bLastWrite = NumPending == 0 && v == NumVisibility - 1;
+		SetCustomDataValue(PendingVisibilityIndices[v], VisibilityCustomDataIndex, PendingVisibilityValues[v], bLastWrite);
+	}
+	PendingVisibilityIndices.Reset();
+	PendingVisibilityValues.Reset();
+
+	//What was sent directly is out of date once the engine path writes
+	if (InstanceUploadBuffer.Num() > 0)
+	{
+		InstanceUploadBuffer.Reset(0);
+	}
+
+	//Submit each run of consecutive instances, only the last run marks the render state dirty
+	//and updates the tree/bounds, so it happens once for the whole tick
+	int32 RunStart = 0;
+	while (RunStart < NumPending)
+	{
+		int32 RunEnd = RunStart + 1;
+		while (RunEnd < NumPending && PendingIndices[RunEnd] == PendingIndices[RunEnd - 1] + 1)
+		{
+			RunEnd++;
+		}
+
+		const bool bLastRun = RunEnd == NumPending;
+		if (RunStart == 0 && bLastRun)
+		{
+			BatchUpdateInstancesTransforms(PendingIndices[0], PendingTransforms, true, true, false);
+		}
+		else
+		{
+			PendingRunTransforms.Reset();
+			PendingRunTransforms.Append(PendingTransforms.GetData() + RunStart, RunEnd - RunStart);
+			BatchUpdateInstancesTransforms(PendingIndices[RunStart], PendingRunTransforms, true, bLastRun, false);
+		}
+
+		RunStart = RunEnd;
+	}
+
+	if (NumPending == 0)
+	{
+		INC_DWORD_STAT(STAT_HIPointRenderStateUpdates);
+		RenderStateUpdatesLastTick++;
+		return;
+	}
+
+	INC_DWORD_STAT_BY(STAT_HIPointInstancesUpdated, NumPending);
+	INC_DWORD_STAT(STAT_HIPointRenderStateUpdates);
+	RenderStateUpdatesLastTick++;
+
+	PendingIndices.Reset();
+	PendingTransforms.Reset();
+}
+
+void UHInstancedPointComponent::NotifyInstancesChanged(bool bInstancesRemoved)
+{
+	InvalidateLocationCache();
+	if (bInstancesRemoved)
+	{
+		ResetInstancePointIndices();
+	}
+}
+
+void UHInstancedPointComponent::InvalidateLocationCache()
+{
+	LocationCache.MarkDirty();
+	ViewGate.ForceUpdate();
+	NameSetVersion++;
+
+	if (bMaterialBillboard && !bMaterialBillboardDirty)
+	{
+		bMaterialBillboardDirty = true;
+		if (!bCentralUpdate && IsRegistered())
+		{
+			SetComponentTickEnabled(true);
+		}
+	}
+}
+
+void UHInstancedPointComponent::SetInstancePointIndices(int32 FirstInstance, TArrayView<const int32> PointIndices)
+{
+	if (FirstInstance < 0)
+	{
+		return;
+	}
+	if (InstancePointIndices.Num() < FirstInstance + PointIndices.Num())
+	{
+		const int32 OldNum = InstancePointIndices.Num();
+		InstancePointIndices.SetNumUninitialized(FirstInstance + PointIndices.Num());
+		for (int32 i = OldNum; i < FirstInstance; i++)
+		{
+			InstancePointIndices[i] = INDEX_NONE;
+		}
+	}
+
+	for (int32 i = 0; i < PointIndices.Num(); i++)
+	{
+		const int32 InstanceIndex = FirstInstance + i;
+		InstancePointIndices[InstanceIndex] = PointIndices[i];
+		if (PointIndices[i] != InstanceIndex)
+		{
+			RemappedPointInstances.Add(PointIndices[i], InstanceIndex);
+		}
+	}
+}
+
+int32 UHInstancedPointComponent::GetPointIndex(int32 InstanceIndex) const
+{
+	return InstancePointIndices.IsValidIndex(InstanceIndex) ? InstancePointIndices[InstanceIndex] : INDEX_NONE;
+}
+
+int32 UHInstancedPointComponent::GetInstanceIndex(int32 PointIndex) const
+{
+	if (InstancePointIndices.IsValidIndex(PointIndex) && InstancePointIndices[PointIndex] == PointIndex)
+	{
+		return PointIndex;
+	}
+	const int32* InstanceIndex = RemappedPointInstances.Find(PointIndex);
+	return InstanceIndex ? *InstanceIndex : INDEX_NONE;
+}
+
+void UHInstancedPointComponent::ResetInstancePointIndices()
+{
+	InstancePointIndices.Reset();
+	RemappedPointInstances.Reset();
+}
+
+void UHInstancedPointComponent::BeginBulkLoad()
+{
+	if (NumBulkLoads++ == 0)
+	{
+		CommitAsyncBillboardUpdate();
+		AbandonTimeSlicedPass();
+		bAutoRebuildTreeOnInstanceChanges = false;
+	}
+}
+
+void UHInstancedPointComponent::EndBulkLoad()
+{
+	if (NumBulkLoads == 0 || --NumBulkLoads > 0)
+	{
+		return;
+	}
+
+	//A loader collected with the world still balances the count, but nothing is rebuilt for a dying component
+	if (IsPendingKillOrUnreachable() || HasAnyFlags(RF_BeginDestroyed))
+	{
+		return;
+	}
+
+	InvalidateLocationCache();
+	bStableTreeDirty = true;
+
+	//A stable tree is built and padded by the next update, the material billboard by its next write
+	const bool bStable = (bStableClusterTree || bMaterialBillboard) && MaxBillboardScale > 0.0f;
+	bAutoRebuildTreeOnInstanceChanges = !bStable;
+	if (!bStable && !bMaterialBillboard)
+	{
+		BuildTreeIfOutdated(true, false);
+	}
+}
+
+void UHInstancedPointComponent::SetMaterialBillboard(bool bEnable)
+{
+	//Without a limit the material grows billboards past any bounds the cluster tree can be padded to
+	if (bEnable && MaxBillboardScale <= 0.0f)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: bMaterialBillboard needs a positive MaxBillboardScale"), *GetPathName());
+		return;
+	}
+	if (bMaterialBillboard == bEnable)
+	{
+		return;
+	}
+	bMaterialBillboard = bEnable;
+	bMaterialBillboardDirty = true;
+
+	if (!bEnable)
+	{
+		//Billboard transforms are written again from scratch, with the tree the settings ask for
+		bStableTreeApplied = false;
+		bStableTreeDirty = true;
+		PaddedClusterTree = nullptr;
+		bAutoRebuildTreeOnInstanceChanges = true;
+		InvalidateLocationCache();
+	}
+	if (!bCentralUpdate && IsRegistered())
+	{
+		SetComponentTickEnabled(true);
+	}
+}
+
+void UHInstancedPointComponent::ApplyMaterialBillboard()
+{
+	bMaterialBillboardDirty = false;
+
+	//Nothing else writes the instances from here on
+	CommitAsyncBillboardUpdate();
+	AbandonTimeSlicedPass();
+	InstanceUploadBuffer.Reset(0);
+
+	const int32 InstanceCount = GetInstanceCount();
+	LocationCache.Rebuild(*this);
+	RebuildSpatialIndex();
+
+	//Instances keep their location, the material does rotation and scale
+	TArray<FTransform> Transforms;
+	Transforms.SetNum(InstanceCount);
+	for (int32 i = 0; i < InstanceCount; i++)
+	{
+		Transforms[i] = FTransform(FQuat::Identity, PerInstanceSMData[i].Transform.GetOrigin(), FVector::OneVector);
+	}
+
+	const bool bPadTree = MaxBillboardScale > 0.0f;
+	bAutoRebuildTreeOnInstanceChanges = !bPadTree;
+	if (InstanceCount > 0)
+	{
+		TGuardValue<bool> CommitGuard(bCommittingInstanceTransforms, true);
+		BatchUpdateInstancesTransforms(0, Transforms, false, false, false);
+	}
+
+	const bool bWriteVisibility = CanHideWithCustomData() && (VisibilityCustomDataIndex < MaterialCustomDataIndex || VisibilityCustomDataIndex > MaterialCustomDataIndex + 3);
+	const int32 NumFloatsNeeded = FMath::Max(MaterialCustomDataIndex + 4, bWriteVisibility ? VisibilityCustomDataIndex + 1 : 0);
+	if (NumCustomDataFloats < NumFloatsNeeded)
+	{
+		SetNumCustomDataFloats(NumFloatsNeeded);
+	}
+	for (int32 i = 0; i < InstanceCount; i++)
+	{
+		SetCustomDataValue(i, MaterialCustomDataIndex, LocationCache.X[i], false);
+		SetCustomDataValue(i, MaterialCustomDataIndex + 1, LocationCache.Y[i], false);
+		SetCustomDataValue(i, MaterialCustomDataIndex + 2, LocationCache.Z[i], false);
+		SetCustomDataValue(i, MaterialCustomDataIndex + 3, BoundSize, false);
+		if (bWriteVisibility)
+		{
+			SetCustomDataValue(i, VisibilityCustomDataIndex, 1.0f, false);
+		}
+	}
+
+	//The tree is built from scale 1, pad it to the scales the material can reach
+	bStableTreeApplied = false;
+	PaddedClusterTree = nullptr;
+	if (bPadTree && InstanceCount > 0)
+	{
+		BuildTree();
+		if (FPointClusterCuller::PadClusterTree(*this, LocationCache, GetMinScale3D().X, MaxBillboardScale))
+		{
+			PaddedClusterTree = ClusterTreePtr.Get();
+		}
+	}
+	bStableTreeDirty = true;
+
+	NumShownInstances = InstanceCount;
+	ReportShownInstances();
+
+	UpdateMaterialBillboardParameters();
+	MarkRenderStateDirty();
+	RenderStateUpdatesLastTick = 1;
+	INC_DWORD_STAT(STAT_HIPointRenderStateUpdates);
+}
+
+void UHInstancedPointComponent::UpdateMaterialBillboardParameters()
+{
+	if (!bMaterialBillboard)
+	{
+		return;
+	}
+
+	for (int32 i = 0; i < GetNumMaterials(); i++)
+	{
+		if (UMaterialInstanceDynamic* Material = CreateDynamicMaterialInstance(i))
+		{
+			Material->SetScalarParameterValue(TEXT("IP_ScreenSize"), ScreenSize);
+			Material->SetScalarParameterValue(TEXT("IP_PatternCullingDistance"), bCulling ? PatternCullingDistance : 0.0f);
+			Material->SetScalarParameterValue(TEXT("IP_MaxScale"), MaxBillboardScale);
+			Material->SetScalarParameterValue(TEXT("IP_LockZ"), bLockZ ? 1.0f : 0.0f);
+		}
+	}
+}
+
+bool UHInstancedPointComponent::CanUpdateTransform()
+{
+	return GetStaticMesh() && IsVisible() && bSetBoundSize && GetInstanceCount() > 0;
+}
+
+void UHInstancedPointComponent::SetCulling(float PatternDis, float NameDis)
+{
+	PatternCullingDistance = PatternDis;
+	NameCullingDistance = NameDis;
+	ViewGate.ForceUpdate();
+	UpdateMaterialBillboardParameters();
+}
+
+void UHInstancedPointComponent::SetPointName(int32 Index, const FString& Name)
+{
+	const FString* OldName = NameMap.Find(Index);
+	if (!OldName || !OldName->Equals(Name, ESearchCase::CaseSensitive))
+	{
+		NameMap.Add(Index, Name);
+		NameContentVersion++;
+	}
+}
+
+void UHInstancedPointComponent::RemovePointName(int32 Index)
+{
+	if (NameMap.Remove(Index) > 0)
+	{
+		NameContentVersion++;
+	}
+}
+
+void UHInstancedPointComponent::SetNamePriority(int32 Index, float Priority)
+{
+	const float* OldPriority = NamePriorityMap.Find(Index);
+	if (!OldPriority || *OldPriority != Priority)
+	{
+		NamePriorityMap.Add(Index, Priority);
+		NameContentVersion++;
+	}
+}
+
+#if WITH_EDITOR
+void UHInstancedPointComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	const FName PropertyName = PropertyChangedEvent.GetPropertyName();
+	if (PropertyName == GET_MEMBER_NAME_CHECKED(UHInstancedPointComponent, NameMap) || PropertyName == GET_MEMBER_NAME_CHECKED(UHInstancedPointComponent, NamePriorityMap))
+	{
+		NameContentVersion++;
+	}
+}
+#endif
+
+void UHInstancedPointComponent::SetLockZ(bool Lock)
+{
+	bLockZ = Lock;
+	ViewGate.ForceUpdate();
+	UpdateMaterialBillboardParameters();
+}
+
+void UHInstancedPointComponent::UpdateName(float ScrDis, int32 InstIndex, FVector InstanceLocation)
+{
+	if (InstIndex >= NameShownBits.Num())
+	{
+		NameShownBits.Add(false, InstIndex + 1 - NameShownBits.Num());
+	}
+
+	const bool bShow = ScrDis < NameCullingDistance;
+	if (NameShownBits[InstIndex] == bShow)
+	{
+		return;
+	}
+	NameShownBits[InstIndex] = bShow;
+	NameSetVersion++;
+
+	if (bShow)
+	{
+		NamesEntered.Add(InstIndex);
+	}
+	else
+	{
+		NamesExited.Add(InstIndex);
+	}
+
+	if (bBroadcastPerInstanceNameEvents)
+	{
+		EOnCullingName.Broadcast(Type, InstIndex, InstanceLocation, !bShow);
+	}
+}
+
+void UHInstancedPointComponent::BroadcastNameChanges()
+{
+	if (NamesEntered.Num() == 0 && NamesExited.Num() == 0)
+	{
+		return;
+	}
+
+	INC_DWORD_STAT_BY(STAT_HIPointNameChanges, NamesEntered.Num() + NamesExited.Num());
+	OnNamesCulled.Broadcast(Type, NamesEntered, NamesExited);
+	NamesEntered.Reset();
+	NamesExited.Reset();
+}
+
+bool UHInstancedPointComponent::IsNameShown(int32 Index) const
+{
+	return NameShownBits.IsValidIndex(Index) && NameShownBits[Index];
+}
+
+TArray<int32> UHInstancedPointComponent::GetShownNames() const
+{
+	TArray<int32> Indices;
+	for (TConstSetBitIterator<> It(NameShownBits); It; ++It)
+	{
+		Indices.Add(It.GetIndex());
+	}
+	return Indices;
+}
+
+FVector UHInstancedPointComponent::GetPointLocation(int32 Index) const
+{
+	if (!LocationCache.IsDirty() && Index >= 0 && Index < LocationCache.Num())
 	{
-		//NewScale = InInstanceTransform.GetScale3D();
-		NewScale = GetMinScale3D();
+		return LocationCache.GetLocation(Index);
 	}
-	//FVector NewScale = FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
-	FRotator NewRotator = FRotationMatrix::MakeFromYZ(ControllerForward, (bLockZ ? FVector(0.0, 0.0, 1.0) : ControllerUp)).Rotator();
-	//FRotator NewRotator = FRotationMatrix::MakeFromYZ(ControllerForward, ControllerUp).Rotator();
-	FTransform NewTransform = FTransform(NewRotator, InstanceLocation, NewScale);
 
-	UpdateInstanceTransform(InstIndex, NewTransform, true, true);
+	FTransform InstanceTransform;
+	GetInstanceTransform(Index, InstanceTransform, true);
+	return InstanceTransform.GetLocation();
 }
 
 void UHInstancedPointComponent::FilterOffname()
 {
 	OnFilterOffName.Broadcast(Type);
-	ShowNameMap.Empty();
+	NameShownBits.Init(false, NameShownBits.Num());
+	NameSetVersion++;
+	NamesEntered.Reset();
+	NamesExited.Reset();
+	ViewGate.ForceUpdate();
 }
 
 FTransform UHInstancedPointComponent::GetMinTransform(FVector Loc)
@@ -2,6 +2,7 @@
 
 
 #include "InstancedPointComponent.h"
+#include "InstancedPointSubsystem.h"
 
 
 UInstancedPointComponent::UInstancedPointComponent(const FObjectInitializer& PCIP)
@@ -15,6 +16,7 @@ float UInstancedPointComponent::SetBoundsSize()
 	FVector MeshExtent = GetStaticMesh()->GetBounds().BoxExtent;
 	BoundSize = FMath::Max<float>(MeshExtent.X, MeshExtent.Y);
 	bSetBoundSize = true;
+	ViewGate.ForceUpdate();
 	return BoundSize = FMath::Max<float>(BoundSize, MeshExtent.Z);
 }
 
@@ -22,37 +24,112 @@ void UInstancedPointComponent::TickComponent(float DeltaTime, ELevelTick TickTyp
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	UpdateTransform();
+	if (ShouldUpdateThisFrame())
+	{
+		UpdateTransform();
+	}
 	//UE_LOG(LogTemp, Warning, TEXT("IPC"));
 
 }
 
+bool UInstancedPointComponent::ShouldUpdateThisFrame()
+{
+	const FPointViewState* View = UInstancedPointSubsystem::FindViewState(this);
+	return bSetBoundSize && GetStaticMesh() && GetInstanceCount() > 0 && (!View || ViewGate.ShouldUpdate(View->Camera, CameraUpdateTolerance));
+}
+
+void UInstancedPointComponent::RegisterComponentTickFunctions(bool bRegister)
+{
+	Super::RegisterComponentTickFunctions(bRegister);
+
+	//The subsystem updates us, registering the tick function turned it back on
+	if (bRegister && bCentralUpdate)
+	{
+		SetComponentTickEnabled(false);
+	}
+}
+
+void UInstancedPointComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	UWorld* World = GetWorld();
+	UInstancedPointSubsystem* Subsystem = World && World->IsGameWorld() ? World->GetSubsystem<UInstancedPointSubsystem>() : nullptr;
+	bCentralUpdate = Subsystem && Subsystem->RegisterPointComponent(this);
+	if (bCentralUpdate)
+	{
+		SetComponentTickEnabled(false);
+	}
+}
+
+void UInstancedPointComponent::OnUnregister()
+{
+	if (bCentralUpdate)
+	{
+		if (UInstancedPointSubsystem* Subsystem = GetWorld() ? GetWorld()->GetSubsystem<UInstancedPointSubsystem>() : nullptr)
+		{
+			Subsystem->UnregisterPointComponent(this);
+		}
+		bCentralUpdate = false;
+	}
+
+	Super::OnUnregister();
+}
+
 void UInstancedPointComponent::UpdateTransform()
 {
 	if(GetStaticMesh())
 	if (bSetBoundSize && GetStaticMesh() && GetInstanceCount() > 0)
 	{
-		for (int32 i = 0; i < GetInstanceCount(); i++)
+		const FPointViewState* View = UInstancedPointSubsystem::FindViewState(this);
+		if (!View)
 		{
-			FTransform InstanceTransform;
-			GetInstanceTransform(i, InstanceTransform, true);
-			FVector InstanceLocation = InstanceTransform.GetLocation();
-
-			AActor* FriController= GetWorld()->GetFirstPlayerController();
-			FVector ControllerUp = FriController->GetActorUpVector();
-			FVector ControllerForward = FriController->GetActorForwardVector() * FVector(-1.0, -1.0, 0.0);
-			ControllerForward.Normalize(0.0001);
-
-			FVector2D ScreenLocationA;
-			FVector2D ScreenLocationB;
-			GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation, ScreenLocationA, true);
-			GetWorld()->GetFirstPlayerController()->ProjectWorldLocationToScreen(InstanceLocation + (ControllerUp * BoundSize), ScreenLocationB, true);
-			
-			FVector NewScale =FVector(ScreenSize / (ScreenLocationA - ScreenLocationB).Size());
-			FRotator NewRotator = FRotationMatrix::MakeFromYZ(ControllerForward, FVector(0.0, 0.0, 1.0)).Rotator();
-			FTransform NewTransform = FTransform(NewRotator, InstanceLocation, NewScale);
-
-			UpdateInstanceTransform(i, NewTransform, true, true);
+			return;
 		}
+		ScreenProjector = View->Projector;
+
+		FRotator NewRotator = FPointBillboardUpdate::MakeBillboardRotator(true, View->ControllerForward, View->ControllerUp);
+
+		if (LocationCache.IsDirty() || LocationCache.Num() != GetInstanceCount())
+		{
+			LocationCache.Rebuild(*this);
+
+			BillboardCandidates.SetNumUninitialized(LocationCache.Num());
+			for (int32 i = 0; i < BillboardCandidates.Num(); i++)
+			{
+				BillboardCandidates[i] = i;
+			}
+		}
+
+		//Every instance faces the camera, no culling or selection
+		FPointBillboardParams Params;
+		Params.CameraLocation = View->CameraLocation;
+		Params.UpOffset = View->ControllerUp * BoundSize;
+		Params.ScreenSize = ScreenSize;
+		Params.bCulling = false;
+
+		const int32 NumChunks = FPointBillboardUpdate::GetNumChunks(BillboardCandidates.Num(), true);
+		FPointBillboardUpdate::Compute(Params, ScreenProjector, LocationCache, BillboardCandidates, NumChunks, BillboardScratch, BillboardOutput);
+
+		NewInstanceTransforms.SetNum(BillboardCandidates.Num(), false);
+		for (int32 i = 0; i < BillboardCandidates.Num(); i++)
+		{
+			NewInstanceTransforms[i] = FTransform(NewRotator, LocationCache.GetLocation(i), FVector(BillboardOutput.Scales[i]));
+			LocationCache.AppliedScale[i] = BillboardOutput.Scales[i];
+		}
+
+		TGuardValue<bool> CommitGuard(bCommittingInstanceTransforms, true);
+		BatchUpdateInstancesTransforms(0, NewInstanceTransforms, true, true, false);
 	}
+}
+
+void UInstancedPointComponent::NotifyInstancesChanged(bool bInstancesRemoved)
+{
+	InvalidateLocationCache();
+}
+
+void UInstancedPointComponent::InvalidateLocationCache()
+{
+	LocationCache.MarkDirty();
+	ViewGate.ForceUpdate();
 }
\ No newline at end of file
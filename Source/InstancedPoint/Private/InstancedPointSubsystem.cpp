@@ -0,0 +1,219 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InstancedPointSubsystem.h"
+#include "HInstancedPointComponent.h"
+#include "InstancedPointComponent.h"
+#include "InstancedPoint.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/World.h"
+
+DECLARE_CYCLE_STAT(TEXT("Point Subsystem Tick"), STAT_PointSubsystemTick, STATGROUP_InstancedPoint);
+DECLARE_CYCLE_STAT(TEXT("Point Subsystem Compute"), STAT_PointSubsystemCompute, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Components Updated"), STAT_PointComponentsUpdated, STATGROUP_InstancedPoint);
+
+static TAutoConsoleVariable<int32> CVarCentralPointUpdate(
+	TEXT("ip.CentralPointUpdate"),
+	1,
+	TEXT("Update point components from their world's UInstancedPointSubsystem instead of their own tick.\n")
+	TEXT("Read when a component registers."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBillboardBudgetMicroseconds(
+	TEXT("ip.BillboardBudgetMicroseconds"),
+	2000.0f,
+	TEXT("Game thread time per frame shared by all time sliced point components of a world."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBillboardBudgetInstances(
+	TEXT("ip.BillboardBudgetInstances"),
+	0,
+	TEXT("Instances per frame shared by all time sliced point components of a world, 0 for no limit."),
+	ECVF_Default);
+
+bool UInstancedPointSubsystem::RegisterPointComponent(UHInstancedPointComponent* Component)
+{
+	if (CVarCentralPointUpdate.GetValueOnGameThread() == 0)
+	{
+		return false;
+	}
+	HierarchicalComponents.AddUnique(Component);
+	return true;
+}
+
+bool UInstancedPointSubsystem::RegisterPointComponent(UInstancedPointComponent* Component)
+{
+	if (CVarCentralPointUpdate.GetValueOnGameThread() == 0)
+	{
+		return false;
+	}
+	InstancedComponents.AddUnique(Component);
+	return true;
+}
+
+void UInstancedPointSubsystem::UnregisterPointComponent(UHInstancedPointComponent* Component)
+{
+	HierarchicalComponents.Remove(Component);
+}
+
+void UInstancedPointSubsystem::UnregisterPointComponent(UInstancedPointComponent* Component)
+{
+	InstancedComponents.Remove(Component);
+}
+
+bool UInstancedPointSubsystem::IsTickable() const
+{
+	return !IsTemplate() && (HierarchicalComponents.Num() > 0 || InstancedComponents.Num() > 0);
+}
+
+TStatId UInstancedPointSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UInstancedPointSubsystem, STATGROUP_Tickables);
+}
+
+void UInstancedPointSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_PointSubsystemTick);
+
+	//Gather on the game thread, components that leave the compute pass to us are collected
+	DeferredComponents.Reset();
+	for (int32 Index = 0; Index < HierarchicalComponents.Num(); Index++)
+	{
+		UHInstancedPointComponent* Component = HierarchicalComponents[Index].Get();
+		if (!Component)
+		{
+			HierarchicalComponents.RemoveAtSwap(Index--);
+			continue;
+		}
+
+		if (Component->ShouldUpdateThisFrame())
+		{
+			INC_DWORD_STAT(STAT_PointComponentsUpdated);
+			if (Component->UpdateTransformDeferred())
+			{
+				DeferredComponents.Add(Component);
+			}
+		}
+	}
+
+	for (int32 Index = 0; Index < InstancedComponents.Num(); Index++)
+	{
+		UInstancedPointComponent* Component = InstancedComponents[Index].Get();
+		if (!Component)
+		{
+			InstancedComponents.RemoveAtSwap(Index--);
+			continue;
+		}
+
+		if (Component->ShouldUpdateThisFrame())
+		{
+			INC_DWORD_STAT(STAT_PointComponentsUpdated);
+			Component->UpdateTransform();
+		}
+	}
+
+	if (DeferredComponents.Num() == 0)
+	{
+		return;
+	}
+
+	//Every component's candidates split into chunks, all dispatched at once
+	ComputeJobs.Reset();
+	for (UHInstancedPointComponent* Component : DeferredComponents)
+	{
+		const int32 NumCandidates = Component->GetNumDeferredCandidates();
+		const int32 NumChunks = FPointBillboardUpdate::GetNumChunks(NumCandidates, Component->bParallelUpdate);
+		const int32 ChunkSize = FMath::Max(FMath::DivideAndRoundUp(NumCandidates, NumChunks), 1);
+		for (int32 Start = 0; Start < NumCandidates; Start += ChunkSize)
+		{
+			ComputeJobs.Add({ Component, Start, FMath::Min(Start + ChunkSize, NumCandidates) });
+		}
+	}
+
+	if (ComputeScratch.Num() < ComputeJobs.Num())
+	{
+		ComputeScratch.SetNum(ComputeJobs.Num());
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_PointSubsystemCompute);
+		ParallelFor(ComputeJobs.Num(), [this](int32 JobIndex)
+		{
+			const FComputeJob& Job = ComputeJobs[JobIndex];
+			Job.Component->ComputeDeferredRange(Job.Start, Job.End, ComputeScratch[JobIndex]);
+		}, ComputeJobs.Num() <= 1 || !FPointBillboardUpdate::IsParallelEnabled());
+	}
+
+	//Commit in registration order on the game thread
+	for (UHInstancedPointComponent* Component : DeferredComponents)
+	{
+		Component->FinishDeferredUpdate();
+	}
+	DeferredComponents.Reset();
+}
+
+const FPointViewState& UInstancedPointSubsystem::GetViewState()
+{
+	if (!bViewStateOverride && ViewState.FrameNumber != GFrameCounter)
+	{
+		ViewState.Capture(GetWorld());
+	}
+	return ViewState;
+}
+
+const FPointViewState* UInstancedPointSubsystem::FindViewState(const UObject* WorldContext)
+{
+	UWorld* World = WorldContext ? WorldContext->GetWorld() : nullptr;
+	UInstancedPointSubsystem* Subsystem = World ? World->GetSubsystem<UInstancedPointSubsystem>() : nullptr;
+	if (!Subsystem)
+	{
+		return nullptr;
+	}
+
+	const FPointViewState& State = Subsystem->GetViewState();
+	return State.IsValid() ? &State : nullptr;
+}
+
+void UInstancedPointSubsystem::SetViewStateOverride(const FPointViewState& InViewState)
+{
+	ViewState = InViewState;
+	bViewStateOverride = true;
+}
+
+void UInstancedPointSubsystem::ClearViewStateOverride()
+{
+	bViewStateOverride = false;
+	ViewState.FrameNumber = 0;
+}
+
+void UInstancedPointSubsystem::AcquireBillboardBudget(double& OutMicroseconds, int32& OutInstances)
+{
+	BeginBudgetFrame();
+
+	//Components that ran last frame are expected again, whoever asks first does not get it all
+	const int32 NumExpected = FMath::Max(NumServedLastFrame, NumServed + 1) - NumServed;
+	OutMicroseconds = RemainingMicroseconds / NumExpected;
+	OutInstances = CVarBillboardBudgetInstances.GetValueOnGameThread() > 0 ? FMath::Max(RemainingInstances / NumExpected, 1) : 0;
+	NumServed++;
+}
+
+void UInstancedPointSubsystem::ReleaseBillboardBudget(double UsedMicroseconds, int32 UsedInstances)
+{
+	RemainingMicroseconds = FMath::Max(RemainingMicroseconds - UsedMicroseconds, 0.0);
+	RemainingInstances = FMath::Max(RemainingInstances - UsedInstances, 0);
+}
+
+void UInstancedPointSubsystem::BeginBudgetFrame()
+{
+	if (BudgetFrame == GFrameCounter)
+	{
+		return;
+	}
+
+	NumServedLastFrame = BudgetFrame + 1 == GFrameCounter ? NumServed : 0;
+	BudgetFrame = GFrameCounter;
+	NumServed = 0;
+	RemainingMicroseconds = FMath::Max(CVarBillboardBudgetMicroseconds.GetValueOnGameThread(), 0.0f);
+	RemainingInstances = FMath::Max(CVarBillboardBudgetInstances.GetValueOnGameThread(), 0);
+}
@@ -0,0 +1,265 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointBillboardUpdate.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/InverseRotationMatrix.h"
+#include "Math/PerspectiveMatrix.h"
+#include "Misc/App.h"
+
+static TAutoConsoleVariable<int32> CVarParallelBillboardUpdate(
+	TEXT("ip.ParallelBillboardUpdate"),
+	1,
+	TEXT("Split the billboard update of point components across the task graph.\n")
+	TEXT(" 0: always single threaded\n")
+	TEXT(" 1: parallel for components that allow it (default)"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBillboardUpdateChunkSize(
+	TEXT("ip.BillboardUpdateChunkSize"),
+	8192,
+	TEXT("Instances per task of the parallel billboard update."),
+	ECVF_Default);
+
+template<typename PolicyType>
+void FPointBillboardUpdate::ComputeRangeKernel(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 Start, int32 End, FPointBillboardChunkScratch& Scratch, FPointBillboardOutput& Output)
+{
+	Scratch.ProjectSlots.Reset();
+
+	const double PatternDistanceSquared = (double)Params.PatternCullingDistance * Params.PatternCullingDistance;
+	const float MaxScale = Params.MaxScale > 0.0f ? Params.MaxScale : MAX_flt;
+
+	for (int32 k = Start; k < End; k++)
+	{
+		const int32 i = Candidates[k];
+		const double DistanceSquared = Locations.DistanceSquared(i, Params.CameraLocation);
+		Output.Distances[k] = FMath::Sqrt(DistanceSquared);
+		Output.Scales[k] = Params.MinScale;
+
+		if (PolicyType::bHasSelection && i == Params.SelectedInstanceIndex)
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::Collapse;
+		}
+		else if (!PolicyType::bCulling)
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::Billboard;
+			Scratch.ProjectSlots.Add(k);
+		}
+		else if (DistanceSquared < PatternDistanceSquared)
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::OffScreen;
+			if (!PolicyType::bFrustumCulled || Params.CandidateFrustum[k] != (uint8)EPointFrustumResult::Outside)
+			{
+				Scratch.ProjectSlots.Add(k);
+			}
+		}
+		else if (Locations.AppliedScale[i] == Params.MinScale)
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::None;
+		}
+		else
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::Collapse;
+		}
+	}
+
+	//Slots are positions in Candidates, the projection wants instance indices
+	Scratch.ProjectInstances.SetNumUninitialized(Scratch.ProjectSlots.Num(), false);
+	for (int32 p = 0; p < Scratch.ProjectSlots.Num(); p++)
+	{
+		Scratch.ProjectInstances[p] = Candidates[Scratch.ProjectSlots[p]];
+	}
+
+	Projector.ProjectScales(Locations, Scratch.ProjectInstances, Params.UpOffset, Params.ScreenSize, Scratch.ProjectedScales, Scratch.ProjectedInViewport);
+
+	for (int32 p = 0; p < Scratch.ProjectSlots.Num(); p++)
+	{
+		const int32 k = Scratch.ProjectSlots[p];
+		if (!PolicyType::bCulling)
+		{
+			Output.Scales[k] = FMath::Min(Scratch.ProjectedScales[p], MaxScale);
+		}
+		else if (Scratch.ProjectedInViewport[p] || (PolicyType::bFrustumCulled && Params.CandidateFrustum[k] == (uint8)EPointFrustumResult::Inside))
+		{
+			Output.Actions[k] = (uint8)EPointBillboardAction::Billboard;
+			Output.Scales[k] = FMath::Min(Scratch.ProjectedScales[p], MaxScale);
+		}
+	}
+}
+
+void FPointBillboardUpdate::ComputeRange(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 Start, int32 End, FPointBillboardChunkScratch& Scratch, FPointBillboardOutput& Output)
+{
+	const bool bHasSelection = Params.SelectedInstanceIndex != INDEX_NONE;
+	const bool bFrustumCulled = Params.CandidateFrustum.Num() > 0;
+
+	if (!Params.bCulling)
+	{
+		if (bHasSelection)
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<false, true, false>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+		else
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<false, false, false>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+	}
+	else if (bFrustumCulled)
+	{
+		if (bHasSelection)
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<true, true, true>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+		else
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<true, false, true>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+	}
+	else
+	{
+		if (bHasSelection)
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<true, true, false>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+		else
+		{
+			ComputeRangeKernel<TPointBillboardPolicy<true, false, false>>(Params, Projector, Locations, Candidates, Start, End, Scratch, Output);
+		}
+	}
+}
+
+void FPointBillboardUpdate::Compute(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 NumChunks, TArray<FPointBillboardChunkScratch>& Scratch, FPointBillboardOutput& Output)
+{
+	const int32 NumCandidates = Candidates.Num();
+	Output.SetNum(NumCandidates);
+
+	NumChunks = FMath::Clamp(NumChunks, 1, FMath::Max(NumCandidates, 1));
+	if (Scratch.Num() < NumChunks)
+	{
+		Scratch.SetNum(NumChunks);
+	}
+
+	if (NumChunks == 1)
+	{
+		ComputeRange(Params, Projector, Locations, Candidates, 0, NumCandidates, Scratch[0], Output);
+		return;
+	}
+
+	const int32 ChunkSize = FMath::DivideAndRoundUp(NumCandidates, NumChunks);
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int32 Start = ChunkIndex * ChunkSize;
+		const int32 End = FMath::Min(Start + ChunkSize, NumCandidates);
+		if (Start < End)
+		{
+			ComputeRange(Params, Projector, Locations, Candidates, Start, End, Scratch[ChunkIndex], Output);
+		}
+	});
+}
+
+int32 FPointBillboardUpdate::GetNumChunks(int32 NumCandidates, bool bAllowParallel)
+{
+	if (!bAllowParallel || !IsParallelEnabled())
+	{
+		return 1;
+	}
+
+	const int32 ChunkSize = FMath::Max(CVarBillboardUpdateChunkSize.GetValueOnGameThread(), 256);
+	return FMath::Max(FMath::DivideAndRoundUp(NumCandidates, ChunkSize), 1);
+}
+
+bool FPointBillboardUpdate::IsParallelEnabled()
+{
+	return CVarParallelBillboardUpdate.GetValueOnGameThread() != 0 && FApp::ShouldUseThreadingForPerformance();
+}
+
+template<bool bLockZ>
+FRotator FPointBillboardUpdate::MakeBillboardRotator(const FVector& ControllerForward, const FVector& ControllerUp)
+{
+	FVector Forward = ControllerForward * (bLockZ ? FVector(-1.0, -1.0, 0.0) : FVector(-1.0, -1.0, -1.0));
+	Forward.Normalize(0.0001);
+	return FRotationMatrix::MakeFromYZ(Forward, bLockZ ? FVector(0.0, 0.0, 1.0) : ControllerUp).Rotator();
+}
+
+FRotator FPointBillboardUpdate::MakeBillboardRotator(bool bLockZ, const FVector& ControllerForward, const FVector& ControllerUp)
+{
+	return bLockZ ? MakeBillboardRotator<true>(ControllerForward, ControllerUp) : MakeBillboardRotator<false>(ControllerForward, ControllerUp);
+}
+
+//ip.BenchmarkBillboardUpdate [NumInstances...]
+//Runs the compute pass on random points with 1 to N tasks and logs the time per update
+static void BenchmarkBillboardUpdate(const TArray<FString>& Args)
+{
+	TArray<int32> InstanceCounts;
+	for (const FString& Arg : Args)
+	{
+		InstanceCounts.Add(FCString::Atoi(*Arg));
+	}
+	if (InstanceCounts.Num() == 0)
+	{
+		InstanceCounts = { 100000, 1000000 };
+	}
+
+	const int32 MaxTasks = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	const int32 NumRuns = 10;
+
+	FPointScreenProjector Projector;
+	const FMatrix ViewRotationMatrix = FInverseRotationMatrix(FRotator(-30.0f, 0.0f, 0.0f)) * FMatrix(
+		FPlane(0, 0, 1, 0),
+		FPlane(1, 0, 0, 0),
+		FPlane(0, 1, 0, 0),
+		FPlane(0, 0, 0, 1));
+	const FMatrix ProjectionMatrix = FReversedZPerspectiveMatrix(FMath::DegreesToRadians(45.0f), 1920.0f, 1080.0f, 10.0f);
+	Projector.Init(FVector(0.0f, 0.0f, 50000.0f), ViewRotationMatrix, ProjectionMatrix, FVector2D(1920.0f, 1080.0f), FVector2D(1920.0f, 1080.0f));
+
+	FPointBillboardParams Params;
+	Params.CameraLocation = Projector.ViewOrigin;
+	Params.UpOffset = FVector(0.0f, 0.0f, 100.0f);
+	Params.PatternCullingDistance = 400000.0f;
+
+	for (int32 InstanceCount : InstanceCounts)
+	{
+		FRandomStream Random(InstanceCount);
+		FPointLocationCache Locations;
+		Locations.X.SetNumUninitialized(InstanceCount);
+		Locations.Y.SetNumUninitialized(InstanceCount);
+		Locations.Z.SetNumUninitialized(InstanceCount);
+		Locations.AppliedScale.Init(Params.MinScale, InstanceCount);
+		TArray<int32> Candidates;
+		Candidates.SetNumUninitialized(InstanceCount);
+		for (int32 i = 0; i < InstanceCount; i++)
+		{
+			Locations.X[i] = Random.FRandRange(0.0f, 1000000.0f);
+			Locations.Y[i] = Random.FRandRange(-500000.0f, 500000.0f);
+			Locations.Z[i] = Random.FRandRange(0.0f, 1000.0f);
+			Candidates[i] = i;
+		}
+
+		double SingleTaskTime = 0.0;
+		for (int32 NumTasks = 1; NumTasks <= MaxTasks; NumTasks++)
+		{
+			TArray<FPointBillboardChunkScratch> Scratch;
+			FPointBillboardOutput Output;
+			FPointBillboardUpdate::Compute(Params, Projector, Locations, Candidates, NumTasks, Scratch, Output);
+
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Run = 0; Run < NumRuns; Run++)
+			{
+				FPointBillboardUpdate::Compute(Params, Projector, Locations, Candidates, NumTasks, Scratch, Output);
+			}
+			const double Time = (FPlatformTime::Seconds() - StartTime) * 1000.0 / NumRuns;
+
+			if (NumTasks == 1)
+			{
+				SingleTaskTime = Time;
+			}
+			UE_LOG(LogTemp, Display, TEXT("BillboardUpdate %d instances, %d tasks: %.3f ms (x%.2f)"), InstanceCount, NumTasks, Time, SingleTaskTime / FMath::Max(Time, 0.001));
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkBillboardUpdateCommand(
+	TEXT("ip.BenchmarkBillboardUpdate"),
+	TEXT("Time the point billboard compute pass with 1 to N tasks. Args: instance counts, default 100000 1000000."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBillboardUpdate));
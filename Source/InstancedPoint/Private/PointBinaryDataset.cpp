@@ -0,0 +1,333 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointBinaryDataset.h"
+#include "PointDatasetCache.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Algo/BinarySearch.h"
+
+static_assert(sizeof(FPointBinaryHeader) == 48, "FPointBinaryHeader is part of the file format");
+static_assert(sizeof(FPointBinaryString) == 16, "FPointBinaryString is part of the file format");
+static_assert(sizeof(FPointBinaryType) == 56, "FPointBinaryType is part of the file format");
+static_assert(sizeof(FPointBinaryAttribute) == 16, "FPointBinaryAttribute is part of the file format");
+static_assert(sizeof(FVector) == 12, "Positions are stored as FVector");
+
+FPointBinaryDataset::FPointBinaryDataset()
+{
+}
+
+FPointBinaryDataset::~FPointBinaryDataset()
+{
+	Close();
+}
+
+bool FPointBinaryDataset::Open(const FString& Path)
+{
+	Close();
+
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+	if (!MappedFile || MappedFile->GetFileSize() < (int64)sizeof(FPointBinaryHeader))
+	{
+		Close();
+		return false;
+	}
+	MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+	if (!MappedRegion)
+	{
+		Close();
+		return false;
+	}
+
+	Data = MappedRegion->GetMappedPtr();
+	Size = MappedRegion->GetMappedSize();
+	Header = (const FPointBinaryHeader*)Data;
+	if (!Validate())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s is not a valid binary point file"), *Path);
+		Close();
+		return false;
+	}
+
+	Types = (const FPointBinaryType*)(Data + Header->TypeTableOffset);
+	AttNames = (const FPointBinaryString*)(Data + Header->AttNameTableOffset);
+	return true;
+}
+
+void FPointBinaryDataset::Close()
+{
+	Header = nullptr;
+	Types = nullptr;
+	AttNames = nullptr;
+	Data = nullptr;
+	Size = 0;
+
+	//The region before the file
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+bool FPointBinaryDataset::Validate() const
+{
+	auto InFile = [this](uint64 Offset, uint64 Count, uint64 ElementSize, uint64 Alignment)
+	{
+		return Offset % Alignment == 0 && Offset <= Size && Count <= (Size - Offset) / ElementSize;
+	};
+
+	if (Header->Magic != FPointBinaryHeader::MagicValue || Header->Version != FPointBinaryHeader::CurrentVersion
+		|| !InFile(Header->TypeTableOffset, Header->NumTypes, sizeof(FPointBinaryType), 8)
+		|| !InFile(Header->AttNameTableOffset, Header->NumAttNames, sizeof(FPointBinaryString), 8)
+		|| !InFile(Header->StringDataOffset, Header->StringDataSize, 1, 1))
+	{
+		return false;
+	}
+
+	auto StringInData = [this](const FPointBinaryString& String)
+	{
+		return String.Offset <= Header->StringDataSize && String.Length <= Header->StringDataSize - String.Offset;
+	};
+
+	const FPointBinaryString* Names = (const FPointBinaryString*)(Data + Header->AttNameTableOffset);
+	for (uint32 i = 0; i < Header->NumAttNames; i++)
+	{
+		if (!StringInData(Names[i]))
+		{
+			return false;
+		}
+	}
+
+	//Only the sections are checked, the accessors check the entries they read
+	const FPointBinaryType* TypeTable = (const FPointBinaryType*)(Data + Header->TypeTableOffset);
+	for (uint32 i = 0; i < Header->NumTypes; i++)
+	{
+		const FPointBinaryType& Type = TypeTable[i];
+		if (!StringInData(Type.Name)
+			|| !InFile(Type.IndicesOffset, Type.NumPoints, sizeof(int32), 4)
+			|| !InFile(Type.PositionsOffset, Type.NumPoints, sizeof(FVector), 4)
+			|| !InFile(Type.AttStartOffset, (uint64)Type.NumPoints + 1, sizeof(uint32), 4)
+			|| !InFile(Type.AttributesOffset, Type.NumAttributes, sizeof(FPointBinaryAttribute), 8))
+		{
+			return false;
+		}
+		const uint32* AttStart = (const uint32*)(Data + Type.AttStartOffset);
+		if (AttStart[0] != 0 || AttStart[Type.NumPoints] != Type.NumAttributes)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int32 FPointBinaryDataset::FindType(const FString& Type) const
+{
+	const FTCHARToUTF8 TypeName(*Type);
+	const FUtf8StringView TypeNameView((const UTF8CHAR*)TypeName.Get(), TypeName.Length());
+	for (int32 TypeId = 0; TypeId < GetNumTypes(); TypeId++)
+	{
+		if (GetTypeName(TypeId).Equals(TypeNameView, ESearchCase::CaseSensitive))
+		{
+			return TypeId;
+		}
+	}
+	return INDEX_NONE;
+}
+
+TArrayView<const int32> FPointBinaryDataset::GetIndices(int32 TypeId) const
+{
+	const FPointBinaryType& Type = Types[TypeId];
+	return TArrayView<const int32>((const int32*)(Data + Type.IndicesOffset), Type.NumPoints);
+}
+
+TArrayView<const FVector> FPointBinaryDataset::GetPositions(int32 TypeId) const
+{
+	const FPointBinaryType& Type = Types[TypeId];
+	return TArrayView<const FVector>((const FVector*)(Data + Type.PositionsOffset), Type.NumPoints);
+}
+
+int32 FPointBinaryDataset::FindSlot(int32 TypeId, int32 PointIndex) const
+{
+	const TArrayView<const int32> Indices = GetIndices(TypeId);
+	if (Indices.IsValidIndex(PointIndex) && Indices[PointIndex] == PointIndex)
+	{
+		return PointIndex;
+	}
+
+	//Indices are written ascending
+	const int32 Slot = Algo::LowerBound(Indices, PointIndex);
+	return Indices.IsValidIndex(Slot) && Indices[Slot] == PointIndex ? Slot : INDEX_NONE;
+}
+
+TArrayView<const FPointBinaryAttribute> FPointBinaryDataset::GetAttributes(int32 TypeId, int32 Slot) const
+{
+	const FPointBinaryType& Type = Types[TypeId];
+	if (Slot < 0 || (uint32)Slot >= Type.NumPoints)
+	{
+		return TArrayView<const FPointBinaryAttribute>();
+	}
+
+	const uint32* AttStart = (const uint32*)(Data + Type.AttStartOffset);
+	const uint32 Start = AttStart[Slot];
+	const uint32 End = AttStart[Slot + 1];
+	if (Start > End || End > Type.NumAttributes)
+	{
+		return TArrayView<const FPointBinaryAttribute>();
+	}
+	return TArrayView<const FPointBinaryAttribute>((const FPointBinaryAttribute*)(Data + Type.AttributesOffset) + Start, End - Start);
+}
+
+FUtf8StringView FPointBinaryDataset::GetAttributeName(const FPointBinaryAttribute& Attribute) const
+{
+	return Attribute.NameId < Header->NumAttNames ? GetString(AttNames[Attribute.NameId]) : FUtf8StringView();
+}
+
+FUtf8StringView FPointBinaryDataset::GetAttributeValue(const FPointBinaryAttribute& Attribute) const
+{
+	FPointBinaryString Value;
+	Value.Offset = Attribute.ValueOffset;
+	Value.Length = Attribute.ValueLength;
+	return GetString(Value);
+}
+
+FUtf8StringView FPointBinaryDataset::GetString(const FPointBinaryString& String) const
+{
+	if (String.Offset > Header->StringDataSize || String.Length > Header->StringDataSize - String.Offset)
+	{
+		return FUtf8StringView();
+	}
+	return FUtf8StringView((const UTF8CHAR*)(Data + Header->StringDataOffset + String.Offset), String.Length);
+}
+
+TMap<FString, FString> FPointBinaryDataset::GetAttributeMap(int32 TypeId, int32 Slot) const
+{
+	auto ToString = [](FUtf8StringView View)
+	{
+		const FUTF8ToTCHAR Converted((const ANSICHAR*)View.GetData(), View.Len());
+		return FString(Converted.Length(), Converted.Get());
+	};
+
+	TMap<FString, FString> AttributeMap;
+	const TArrayView<const FPointBinaryAttribute> Attributes = GetAttributes(TypeId, Slot);
+	AttributeMap.Reserve(Attributes.Num());
+	for (const FPointBinaryAttribute& Attribute : Attributes)
+	{
+		AttributeMap.Add(ToString(GetAttributeName(Attribute)), ToString(GetAttributeValue(Attribute)));
+	}
+	return AttributeMap;
+}
+
+bool FPointBinaryDataset::Write(const FPointDataset& Dataset, const FString& Path)
+{
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*Path));
+	if (!Writer)
+	{
+		return false;
+	}
+
+	auto Align = [&Writer](int64 Alignment)
+	{
+		static const uint8 Zeros[16] = {};
+		const int64 Padding = (Alignment - Writer->Tell() % Alignment) % Alignment;
+		Writer->Serialize((void*)Zeros, Padding);
+	};
+
+	TArray<uint8> StringData;
+	auto AddString = [&StringData](const FString& String)
+	{
+		const FTCHARToUTF8 Converted(*String);
+		FPointBinaryString Entry;
+		Entry.Offset = StringData.Num();
+		Entry.Length = Converted.Length();
+		StringData.Append((const uint8*)Converted.Get(), Converted.Length());
+		return Entry;
+	};
+
+	FPointBinaryHeader Header;
+	Header.NumTypes = Dataset.Types.Num();
+	Header.NumAttNames = Dataset.AttNames.Num();
+
+	TArray<FPointBinaryString> AttNameTable;
+	for (const FString& AttName : Dataset.AttNames)
+	{
+		AttNameTable.Add(AddString(AttName));
+	}
+
+	//Tables are written again once the sections are placed
+	TArray<FPointBinaryType> TypeTable;
+	TypeTable.SetNum(Header.NumTypes);
+	Writer->Serialize(&Header, sizeof(Header));
+	Align(8);
+	Header.TypeTableOffset = Writer->Tell();
+	Writer->Serialize(TypeTable.GetData(), TypeTable.Num() * sizeof(FPointBinaryType));
+	Header.AttNameTableOffset = Writer->Tell();
+	Writer->Serialize(AttNameTable.GetData(), AttNameTable.Num() * sizeof(FPointBinaryString));
+
+	int32 TypeId = 0;
+	for (const TPair<FString, FPointDatasetType>& Pair : Dataset.Types)
+	{
+		const FPointDatasetType& PointType = Pair.Value;
+		FPointBinaryType& Type = TypeTable[TypeId++];
+		Type.Name = AddString(Pair.Key);
+		Type.NumPoints = PointType.Num();
+
+		//Ascending point index
+		TArray<int32> Order;
+		Order.SetNumUninitialized(PointType.Num());
+		for (int32 i = 0; i < Order.Num(); i++)
+		{
+			Order[i] = i;
+		}
+		Order.StableSort([&PointType](int32 A, int32 B) { return PointType.PointIndices[A] < PointType.PointIndices[B]; });
+
+		TArray<int32> Indices;
+		TArray<FVector> Positions;
+		TArray<uint32> AttStart;
+		TArray<FPointBinaryAttribute> Attributes;
+		Indices.Reserve(Order.Num());
+		Positions.Reserve(Order.Num());
+		AttStart.Reserve(Order.Num() + 1);
+		Attributes.Reserve(PointType.AttKeys.Num());
+		for (int32 Slot : Order)
+		{
+			Indices.Add(PointType.PointIndices[Slot]);
+			Positions.Add(PointType.Locations[Slot]);
+			AttStart.Add(Attributes.Num());
+			for (int32 i = PointType.AttStart[Slot]; i < PointType.AttStart[Slot + 1]; i++)
+			{
+				const FPointBinaryString Value = AddString(PointType.AttValues[i]);
+				FPointBinaryAttribute& Attribute = Attributes.AddDefaulted_GetRef();
+				Attribute.NameId = PointType.AttKeys[i];
+				Attribute.ValueLength = Value.Length;
+				Attribute.ValueOffset = Value.Offset;
+			}
+		}
+		AttStart.Add(Attributes.Num());
+		Type.NumAttributes = Attributes.Num();
+
+		Align(16);
+		Type.IndicesOffset = Writer->Tell();
+		Writer->Serialize(Indices.GetData(), Indices.Num() * sizeof(int32));
+		Align(16);
+		Type.PositionsOffset = Writer->Tell();
+		Writer->Serialize(Positions.GetData(), Positions.Num() * sizeof(FVector));
+		Align(16);
+		Type.AttStartOffset = Writer->Tell();
+		Writer->Serialize(AttStart.GetData(), AttStart.Num() * sizeof(uint32));
+		Align(16);
+		Type.AttributesOffset = Writer->Tell();
+		Writer->Serialize(Attributes.GetData(), Attributes.Num() * sizeof(FPointBinaryAttribute));
+	}
+
+	Align(16);
+	Header.StringDataOffset = Writer->Tell();
+	Header.StringDataSize = StringData.Num();
+	Writer->Serialize(StringData.GetData(), StringData.Num());
+
+	Writer->Seek(0);
+	Writer->Serialize(&Header, sizeof(Header));
+	Writer->Seek(Header.TypeTableOffset);
+	Writer->Serialize(TypeTable.GetData(), TypeTable.Num() * sizeof(FPointBinaryType));
+
+	const bool bWritten = !Writer->IsError();
+	return Writer->Close() && bWritten;
+}
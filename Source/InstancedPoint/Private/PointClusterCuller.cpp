@@ -0,0 +1,154 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointClusterCuller.h"
+#include "Engine/StaticMesh.h"
+
+bool FPointClusterCuller::Update(const UHierarchicalInstancedStaticMeshComponent& Component, const FPointLocationCache& Locations)
+{
+	const TSharedPtr<TArray<FClusterNode>, ESPMode::ThreadSafe>& Tree = Component.ClusterTreePtr;
+	if (!Tree.IsValid() || Tree->Num() == 0 || Component.SortedInstances.Num() != Locations.Num())
+	{
+		//Tree not built yet or instances added since, wait for the next one
+		NodeBounds.Reset();
+		bBoundsDirty = true;
+		return false;
+	}
+
+	if (Tree != ClusterTree)
+	{
+		//Rebuilds after scale changes and padded copies group the instances the same way,
+		//the node bounds only depend on that grouping and the locations
+		if (!IsValid() || !ClusterTree.IsValid() || !HasSameLayout(*Tree, Component.SortedInstances))
+		{
+			bBoundsDirty = true;
+		}
+		ClusterTree = Tree;
+		NumTreeChanges++;
+	}
+
+	if (!bBoundsDirty)
+	{
+		return IsValid();
+	}
+	bBoundsDirty = false;
+
+	SortedInstances = Component.SortedInstances;
+	NodeBounds.Reset();
+
+	TArray<FBox> Bounds;
+	if (!BuildNodeBounds(*ClusterTree, SortedInstances, Locations, Bounds))
+	{
+		return false;
+	}
+
+	NodeBounds = MoveTemp(Bounds);
+	return true;
+}
+
+bool FPointClusterCuller::HasSameLayout(const TArray<FClusterNode>& Nodes, const TArray<int32>& InSortedInstances) const
+{
+	const TArray<FClusterNode>& CurrentNodes = *ClusterTree;
+	if (Nodes.Num() != CurrentNodes.Num() || InSortedInstances.Num() != SortedInstances.Num())
+	{
+		return false;
+	}
+	for (int32 NodeIndex = 0; NodeIndex < Nodes.Num(); NodeIndex++)
+	{
+		const FClusterNode& Node = Nodes[NodeIndex];
+		const FClusterNode& CurrentNode = CurrentNodes[NodeIndex];
+		if (Node.FirstChild != CurrentNode.FirstChild || Node.LastChild != CurrentNode.LastChild
+			|| Node.FirstInstance != CurrentNode.FirstInstance || Node.LastInstance != CurrentNode.LastInstance)
+		{
+			return false;
+		}
+	}
+	return FMemory::Memcmp(InSortedInstances.GetData(), SortedInstances.GetData(), SortedInstances.Num() * sizeof(int32)) == 0;
+}
+
+bool FPointClusterCuller::BuildNodeBounds(const TArray<FClusterNode>& Nodes, const TArray<int32>& InSortedInstances, const FPointLocationCache& Locations, TArray<FBox>& OutBounds)
+{
+	const int32 InstanceCount = Locations.Num();
+	if (Nodes.Num() == 0 || Nodes[0].FirstInstance != 0 || Nodes[0].LastInstance != InstanceCount - 1)
+	{
+		//Some instances are not in the tree, culling by it would lose them
+		return false;
+	}
+	for (int32 SortedIndex = 0; SortedIndex < InSortedInstances.Num(); SortedIndex++)
+	{
+		if (InSortedInstances[SortedIndex] < 0 || InSortedInstances[SortedIndex] >= InstanceCount)
+		{
+			return false;
+		}
+	}
+
+	OutBounds.Reset();
+	OutBounds.SetNumZeroed(Nodes.Num());
+
+	//Children always come after their parent, so a reverse walk sees them first
+	for (int32 NodeIndex = Nodes.Num() - 1; NodeIndex >= 0; NodeIndex--)
+	{
+		const FClusterNode& Node = Nodes[NodeIndex];
+		if (Node.FirstInstance < 0 || Node.LastInstance >= InSortedInstances.Num())
+		{
+			return false;
+		}
+
+		FBox& NodeBox = OutBounds[NodeIndex];
+		if (Node.FirstChild < 0)
+		{
+			for (int32 SortedIndex = Node.FirstInstance; SortedIndex <= Node.LastInstance; SortedIndex++)
+			{
+				NodeBox += Locations.GetLocation(InSortedInstances[SortedIndex]);
+			}
+		}
+		else
+		{
+			if (Node.FirstChild <= NodeIndex || Node.LastChild >= Nodes.Num())
+			{
+				return false;
+			}
+			for (int32 Child = Node.FirstChild; Child <= Node.LastChild; Child++)
+			{
+				NodeBox += OutBounds[Child];
+			}
+		}
+	}
+	return true;
+}
+
+bool FPointClusterCuller::PadClusterTree(UHierarchicalInstancedStaticMeshComponent& Component, const FPointLocationCache& Locations, float MinScale, float MaxScale)
+{
+	const TSharedPtr<TArray<FClusterNode>, ESPMode::ThreadSafe>& Tree = Component.ClusterTreePtr;
+	if (!Tree.IsValid() || !Component.GetStaticMesh() || Component.SortedInstances.Num() != Locations.Num())
+	{
+		return false;
+	}
+
+	TArray<FBox> Bounds;
+	if (!BuildNodeBounds(*Tree, Component.SortedInstances, Locations, Bounds))
+	{
+		return false;
+	}
+
+	//Any rotation of the mesh at MaxScale stays in this sphere around the instance location
+	const FTransform& ComponentTransform = Component.GetComponentTransform();
+	const FBoxSphereBounds MeshBounds = Component.GetStaticMesh()->GetBounds();
+	const float Radius = (MeshBounds.Origin.Size() + MeshBounds.SphereRadius) * MaxScale * ComponentTransform.GetMaximumAxisScale();
+
+	TSharedPtr<TArray<FClusterNode>, ESPMode::ThreadSafe> PaddedTree = MakeShareable(new TArray<FClusterNode>(*Tree));
+	TArray<FClusterNode>& Nodes = *PaddedTree;
+	for (int32 NodeIndex = 0; NodeIndex < Nodes.Num(); NodeIndex++)
+	{
+		//Node bounds are in component space, the cache is in world space
+		const FBox LocalBox = Bounds[NodeIndex].ExpandBy(Radius).InverseTransformBy(ComponentTransform);
+		Nodes[NodeIndex].BoundMin = LocalBox.Min;
+		Nodes[NodeIndex].BoundMax = LocalBox.Max;
+		Nodes[NodeIndex].MinInstanceScale = FVector(MinScale);
+		Nodes[NodeIndex].MaxInstanceScale = FVector(MaxScale);
+	}
+
+	Component.BuiltInstanceBounds = FBox(Nodes[0].BoundMin, Nodes[0].BoundMax);
+	Component.ClusterTreePtr = PaddedTree;
+	return true;
+}
@@ -0,0 +1,426 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointDatasetCache.h"
+#include "InstancedPoint.h"
+#include "PointJsonStream.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+DECLARE_MEMORY_STAT(TEXT("Point Dataset Cache"), STAT_PointDatasetCacheMemory, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Dataset Cache Hits"), STAT_PointDatasetCacheHits, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Dataset Cache Loads"), STAT_PointDatasetCacheLoads, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Type Location Reads"), STAT_PointTypeLocationReads, STATGROUP_InstancedPoint);
+
+static TAutoConsoleVariable<int32> CVarPointDatasetCacheMB(
+	TEXT("ip.PointDatasetCacheMB"),
+	512,
+	TEXT("Memory kept by parsed point datasets and streamed type locations, least recently used ones are dropped past it."),
+	ECVF_Default);
+
+int32 FPointDatasetType::FindSlot(int32 PointIndex) const
+{
+	if (Slots.Num() == 0)
+	{
+		return PointIndices.IsValidIndex(PointIndex) ? PointIndex : INDEX_NONE;
+	}
+	const int32* Slot = Slots.Find(PointIndex);
+	return Slot ? *Slot : INDEX_NONE;
+}
+
+TMap<FString, FString> FPointDatasetType::GetAttributes(int32 Slot, const TArray<FString>& AttNames) const
+{
+	TMap<FString, FString> Attributes;
+	if (Slot >= 0 && AttStart.IsValidIndex(Slot + 1))
+	{
+		Attributes.Reserve(AttStart[Slot + 1] - AttStart[Slot]);
+		for (int32 i = AttStart[Slot]; i < AttStart[Slot + 1]; i++)
+		{
+			Attributes.Add(AttNames[AttKeys[i]], AttValues[i]);
+		}
+	}
+	return Attributes;
+}
+
+bool FPointDataset::ReadLoc(FPointJsonStream& Stream, FVector& OutLoc)
+{
+	if (!Stream.BeginObject())
+	{
+		return false;
+	}
+
+	OutLoc = FVector::ZeroVector;
+	while (Stream.NextMember())
+	{
+		const int32 Axis = Stream.IsKey("X") ? 0 : Stream.IsKey("Y") ? 1 : Stream.IsKey("Z") ? 2 : INDEX_NONE;
+		double Value = 0.0;
+		if (Axis == INDEX_NONE)
+		{
+			Stream.SkipValue();
+		}
+		else if (Stream.ReadNumber(Value))
+		{
+			OutLoc[Axis] = Value;
+		}
+	}
+	return !Stream.HasError();
+}
+
+bool FPointDataset::Load(const FString& Path, FPointDatasetLoadProgress* Progress)
+{
+	TUniquePtr<FArchive> FileAr(IFileManager::Get().CreateFileReader(*Path));
+	if (!FileAr)
+	{
+		return false;
+	}
+	if (Progress)
+	{
+		Progress->TotalBytes = FileAr->TotalSize();
+	}
+
+	TMap<FString, int32> AttNameIds;
+	FString Value;
+
+	FPointJsonStream Stream(*FileAr);
+	if (!Stream.BeginObject())
+	{
+		return false;
+	}
+	while (Stream.NextMember())
+	{
+		const FString Key = Stream.GetKeyString();
+		if (!Stream.IsObjectNext())
+		{
+			Stream.SkipValue();
+			continue;
+		}
+
+		Stream.BeginObject();
+		FPointDatasetType* PointType = nullptr;
+		while (Stream.NextMember())
+		{
+			int32 PointIndex = 0;
+			if (Stream.GetKeyAsIndex(PointIndex) && Stream.IsObjectNext())
+			{
+				if (!PointType)
+				{
+					PointType = &Types.Add(Key);
+					PointType->AttStart.Add(0);
+				}
+				const int32 Slot = PointType->PointIndices.Add(PointIndex);
+				if (Progress && (Slot & 1023) == 0)
+				{
+					Progress->BytesRead = Stream.GetBytesRead();
+					if (Progress->bCancelled)
+					{
+						return false;
+					}
+				}
+				FVector& Loc = PointType->Locations.Add_GetRef(FVector::ZeroVector);
+
+				Stream.BeginObject();
+				while (Stream.NextMember())
+				{
+					if (Stream.IsKey("Loc"))
+					{
+						ReadLoc(Stream, Loc);
+					}
+					else if (Stream.IsKey("Att") && Stream.IsObjectNext())
+					{
+						Stream.BeginObject();
+						while (Stream.NextMember())
+						{
+							const FString AttName = Stream.GetKeyString();
+							if (Stream.ReadString(Value))
+							{
+								int32* AttId = AttNameIds.Find(AttName);
+								PointType->AttKeys.Add(AttId ? *AttId : AttNameIds.Add(AttName, AttNames.Add(AttName)));
+								PointType->AttValues.Add(Value);
+							}
+						}
+					}
+					else
+					{
+						Stream.SkipValue();
+					}
+				}
+				PointType->AttStart.Add(PointType->AttKeys.Num());
+
+				if (PointIndex != Slot && PointType->Slots.Num() == 0)
+				{
+					//Not 0 to N - 1 in order, look points up by index
+					for (int32 i = 0; i < Slot; i++)
+					{
+						PointType->Slots.Add(PointType->PointIndices[i], i);
+					}
+				}
+				if (PointType->Slots.Num() > 0)
+				{
+					PointType->Slots.Add(PointIndex, Slot);
+				}
+			}
+			else if (Stream.IsKey("InfoMap") && Stream.IsObjectNext())
+			{
+				TMap<FString, FString>& InfoMap = InfoMaps.Add(Key);
+				Stream.BeginObject();
+				while (Stream.NextMember())
+				{
+					const FString InfoKey = Stream.GetKeyString();
+					if (Stream.ReadString(Value))
+					{
+						InfoMap.Add(InfoKey, Value);
+					}
+				}
+			}
+			else
+			{
+				Stream.SkipValue();
+			}
+		}
+	}
+	if (Stream.HasError() || (Progress && Progress->bCancelled))
+	{
+		return false;
+	}
+	if (Progress)
+	{
+		Progress->BytesRead = Progress->TotalBytes.Load();
+	}
+
+	AllocatedSize = sizeof(FPointDataset) + Types.GetAllocatedSize() + InfoMaps.GetAllocatedSize() + AttNames.GetAllocatedSize();
+	for (const FString& AttName : AttNames)
+	{
+		AllocatedSize += AttName.GetAllocatedSize();
+	}
+	for (TPair<FString, FPointDatasetType>& Pair : Types)
+	{
+		FPointDatasetType& PointType = Pair.Value;
+		PointType.PointIndices.Shrink();
+		PointType.Locations.Shrink();
+		PointType.AttStart.Shrink();
+		PointType.AttKeys.Shrink();
+		PointType.AttValues.Shrink();
+
+		AllocatedSize += Pair.Key.GetAllocatedSize() + PointType.PointIndices.GetAllocatedSize() + PointType.Locations.GetAllocatedSize()
+			+ PointType.AttStart.GetAllocatedSize() + PointType.AttKeys.GetAllocatedSize() + PointType.AttValues.GetAllocatedSize() + PointType.Slots.GetAllocatedSize();
+		for (const FString& AttValue : PointType.AttValues)
+		{
+			AllocatedSize += AttValue.GetAllocatedSize();
+		}
+	}
+	for (const TPair<FString, TMap<FString, FString>>& Pair : InfoMaps)
+	{
+		AllocatedSize += Pair.Key.GetAllocatedSize() + Pair.Value.GetAllocatedSize();
+		for (const TPair<FString, FString>& Info : Pair.Value)
+		{
+			AllocatedSize += Info.Key.GetAllocatedSize() + Info.Value.GetAllocatedSize();
+		}
+	}
+	return true;
+}
+
+FPointDatasetCache& FPointDatasetCache::Get()
+{
+	static FPointDatasetCache Cache;
+	return Cache;
+}
+
+FPointDatasetPtr FPointDatasetCache::Find(const FString& Path, FPointDatasetLoadProgress* Progress)
+{
+	const FString FullPath = FPaths::ConvertRelativePathToFull(Path);
+	const FDateTime TimeStamp = IFileManager::Get().GetTimeStamp(*FullPath);
+	if (TimeStamp == FDateTime::MinValue())
+	{
+		Evict(FullPath);
+		return nullptr;
+	}
+
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (FEntry* Entry = Entries.Find(FullPath))
+		{
+			if (Entry->TimeStamp == TimeStamp)
+			{
+				Entry->LastUse = ++UseCounter;
+				INC_DWORD_STAT(STAT_PointDatasetCacheHits);
+				return Entry->Dataset;
+			}
+		}
+	}
+
+	//Parsed outside the lock, other datasets stay available meanwhile
+	TSharedPtr<FPointDataset, ESPMode::ThreadSafe> Dataset = MakeShared<FPointDataset, ESPMode::ThreadSafe>();
+	if (!Dataset->Load(FullPath, Progress))
+	{
+		if (!Progress || !Progress->bCancelled)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Could not read point dataset %s"), *FullPath);
+			Evict(FullPath);
+		}
+		return nullptr;
+	}
+	INC_DWORD_STAT(STAT_PointDatasetCacheLoads);
+
+	FScopeLock ScopeLock(&Lock);
+	FEntry& Entry = Entries.FindOrAdd(FullPath);
+	Entry.Dataset = Dataset;
+	Entry.TimeStamp = TimeStamp;
+	Entry.LastUse = ++UseCounter;
+	Trim();
+	return Dataset;
+}
+
+FPointDatasetPtr FPointDatasetCache::FindCached(const FString& Path)
+{
+	const FString FullPath = FPaths::ConvertRelativePathToFull(Path);
+	const FDateTime TimeStamp = IFileManager::Get().GetTimeStamp(*FullPath);
+
+	FScopeLock ScopeLock(&Lock);
+	FEntry* Entry = Entries.Find(FullPath);
+	if (!Entry || Entry->TimeStamp != TimeStamp)
+	{
+		return nullptr;
+	}
+	Entry->LastUse = ++UseCounter;
+	INC_DWORD_STAT(STAT_PointDatasetCacheHits);
+	return Entry->Dataset;
+}
+
+FPointTypeLocationsPtr FPointDatasetCache::FindTypeLocations(const FString& Path, const FString& Type, FPointTypeLocationsReader ReadLocations)
+{
+	const FString FullPath = FPaths::ConvertRelativePathToFull(Path);
+	const FDateTime TimeStamp = IFileManager::Get().GetTimeStamp(*FullPath);
+	const TPair<FString, FString> Key(FullPath, Type);
+	if (TimeStamp == FDateTime::MinValue())
+	{
+		Evict(FullPath);
+		return nullptr;
+	}
+
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (FTypeLocationsEntry* Entry = TypeEntries.Find(Key))
+		{
+			if (Entry->TimeStamp == TimeStamp)
+			{
+				Entry->LastUse = ++UseCounter;
+				INC_DWORD_STAT(STAT_PointDatasetCacheHits);
+				return Entry->Locations;
+			}
+		}
+	}
+
+	//Read outside the lock, as datasets are
+	TSharedPtr<FPointTypeLocations, ESPMode::ThreadSafe> Locations = MakeShared<FPointTypeLocations, ESPMode::ThreadSafe>();
+	if (!ReadLocations(FullPath, Locations->PointIndices, Locations->Locations))
+	{
+		//Kept empty too, a type the file does not have is not looked for again until it changes
+		Locations->PointIndices.Empty();
+		Locations->Locations.Empty();
+	}
+	INC_DWORD_STAT(STAT_PointTypeLocationReads);
+	Locations->PointIndices.Shrink();
+	Locations->Locations.Shrink();
+	Locations->AllocatedSize = sizeof(FPointTypeLocations) + Key.Key.GetAllocatedSize() + Key.Value.GetAllocatedSize()
+		+ Locations->PointIndices.GetAllocatedSize() + Locations->Locations.GetAllocatedSize();
+
+	FScopeLock ScopeLock(&Lock);
+	FTypeLocationsEntry& Entry = TypeEntries.FindOrAdd(Key);
+	Entry.Locations = Locations;
+	Entry.TimeStamp = TimeStamp;
+	Entry.LastUse = ++UseCounter;
+	Trim();
+	return Locations;
+}
+
+void FPointDatasetCache::Evict(const FString& Path)
+{
+	const FString FullPath = FPaths::ConvertRelativePathToFull(Path);
+
+	FScopeLock ScopeLock(&Lock);
+	Entries.Remove(FullPath);
+	for (auto It = TypeEntries.CreateIterator(); It; ++It)
+	{
+		if (It.Key().Key == FullPath)
+		{
+			It.RemoveCurrent();
+		}
+	}
+	UpdateMemoryStat();
+}
+
+void FPointDatasetCache::Empty()
+{
+	FScopeLock ScopeLock(&Lock);
+	Entries.Empty();
+	TypeEntries.Empty();
+	UpdateMemoryStat();
+}
+
+SIZE_T FPointDatasetCache::GetAllocatedSize() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return GetAllocatedSizeLocked();
+}
+
+SIZE_T FPointDatasetCache::GetAllocatedSizeLocked() const
+{
+	SIZE_T Size = 0;
+	for (const TPair<FString, FEntry>& Pair : Entries)
+	{
+		Size += Pair.Value.Dataset->AllocatedSize;
+	}
+	for (const TPair<TPair<FString, FString>, FTypeLocationsEntry>& Pair : TypeEntries)
+	{
+		Size += Pair.Value.Locations->AllocatedSize;
+	}
+	return Size;
+}
+
+void FPointDatasetCache::Trim()
+{
+	const SIZE_T MaxSize = (SIZE_T)FMath::Max(CVarPointDatasetCacheMB.GetValueOnAnyThread(), 0) * 1024 * 1024;
+	SIZE_T Size = GetAllocatedSizeLocked();
+
+	//Datasets and type locations share the cap, whichever was used longest ago goes first
+	while (Size > MaxSize && Entries.Num() + TypeEntries.Num() > 1)
+	{
+		const TPair<FString, FEntry>* Oldest = nullptr;
+		for (const TPair<FString, FEntry>& Pair : Entries)
+		{
+			if (!Oldest || Pair.Value.LastUse < Oldest->Value.LastUse)
+			{
+				Oldest = &Pair;
+			}
+		}
+		const TPair<TPair<FString, FString>, FTypeLocationsEntry>* OldestType = nullptr;
+		for (const TPair<TPair<FString, FString>, FTypeLocationsEntry>& Pair : TypeEntries)
+		{
+			if (!OldestType || Pair.Value.LastUse < OldestType->Value.LastUse)
+			{
+				OldestType = &Pair;
+			}
+		}
+
+		if (OldestType && (!Oldest || OldestType->Value.LastUse < Oldest->Value.LastUse))
+		{
+			Size -= OldestType->Value.Locations->AllocatedSize;
+			const TPair<FString, FString> OldestKey = OldestType->Key;
+			TypeEntries.Remove(OldestKey);
+		}
+		else
+		{
+			Size -= Oldest->Value.Dataset->AllocatedSize;
+			const FString OldestPath = Oldest->Key;
+			Entries.Remove(OldestPath);
+		}
+	}
+	UpdateMemoryStat();
+}
+
+void FPointDatasetCache::UpdateMemoryStat()
+{
+	SET_MEMORY_STAT(STAT_PointDatasetCacheMemory, GetAllocatedSizeLocked());
+}
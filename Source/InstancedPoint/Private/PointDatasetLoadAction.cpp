@@ -0,0 +1,169 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointDatasetLoadAction.h"
+#include "HInstancedPointComponent.h"
+#include "Async/Async.h"
+#include "Engine/World.h"
+
+UPointDatasetLoadAction* UPointDatasetLoadAction::LoadPointsAsync(UObject* WorldContextObject, UHInstancedPointComponent* Component, FString Type, FString DataPath, int32 InstancesPerFrame)
+{
+	UPointDatasetLoadAction* Action = NewObject<UPointDatasetLoadAction>();
+	Action->Component = Component;
+	Action->Type = Type;
+	Action->DataPath = DataPath;
+	Action->InstancesPerFrame = FMath::Max(InstancesPerFrame, 1);
+	Action->RegisterWithGameInstance(WorldContextObject);
+	return Action;
+}
+
+void UPointDatasetLoadAction::Activate()
+{
+	State = MakeShared<FLoadState, ESPMode::ThreadSafe>();
+
+	//The task only touches the shared state, never the action
+	TSharedPtr<FLoadState, ESPMode::ThreadSafe> TaskState = State;
+	const FString TaskDataPath = DataPath;
+	Async(EAsyncExecution::ThreadPool, [TaskState, TaskDataPath]()
+	{
+		TaskState->Dataset = FPointDatasetCache::Get().Find(TaskDataPath, &TaskState->Progress);
+		TaskState->bParsed = true;
+	});
+
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPointDatasetLoadAction::Tick));
+	WorldCleanupHandle = FWorldDelegates::OnWorldCleanup.AddUObject(this, &UPointDatasetLoadAction::OnWorldCleanup);
+}
+
+void UPointDatasetLoadAction::BeginDestroy()
+{
+	//Not through Finish, the game instance may be going away with us
+	EndLoad();
+
+	Super::BeginDestroy();
+}
+
+void UPointDatasetLoadAction::Cancel()
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	Finish();
+}
+
+void UPointDatasetLoadAction::OnWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources)
+{
+	UHInstancedPointComponent* Target = Component.Get();
+	if (!bFinished && (!Target || Target->GetWorld() == World))
+	{
+		Finish();
+		OnFailed.Broadcast(FMath::Max(LastProgress, 0.0f), NextSlot);
+	}
+}
+
+bool UPointDatasetLoadAction::Tick(float DeltaTime)
+{
+	UHInstancedPointComponent* Target = Component.Get();
+	if (!Target)
+	{
+		Finish();
+		OnFailed.Broadcast(FMath::Max(LastProgress, 0.0f), NextSlot);
+		return false;
+	}
+
+	if (!bAdding)
+	{
+		if (!State->bParsed)
+		{
+			const int64 TotalBytes = State->Progress.TotalBytes;
+			BroadcastProgress(TotalBytes > 0 ? 0.5f * State->Progress.BytesRead / TotalBytes : 0.0f);
+			return true;
+		}
+
+		Dataset = State->Dataset;
+		PointType = Dataset ? Dataset->FindType(Type) : nullptr;
+		if (!PointType)
+		{
+			Finish();
+			OnFailed.Broadcast(0.5f, 0);
+			return false;
+		}
+
+		bAdding = true;
+		Target->BeginBulkLoad();
+		Target->PreAllocateInstancesMemory(PointType->Num());
+	}
+
+	//Same space as AddInstance
+	const int32 End = FMath::Min(NextSlot + InstancesPerFrame, PointType->Num());
+	Transforms.Reset(End - NextSlot);
+	for (int32 Slot = NextSlot; Slot < End; Slot++)
+	{
+		Transforms.Add(FTransform(PointType->Locations[Slot]));
+	}
+	if (Transforms.Num() > 0)
+	{
+		const int32 FirstInstance = Target->GetInstanceCount();
+		Target->AddInstances(Transforms, false);
+		Target->SetInstancePointIndices(FirstInstance, TArrayView<const int32>(PointType->PointIndices).Slice(NextSlot, End - NextSlot));
+	}
+	NextSlot = End;
+
+	if (NextSlot < PointType->Num())
+	{
+		BroadcastProgress(0.5f + 0.5f * NextSlot / PointType->Num());
+		return true;
+	}
+
+	if (!Target->bSetBoundSize && Target->GetStaticMesh())
+	{
+		Target->SetBoundsSize();
+	}
+	Finish();
+	OnCompleted.Broadcast(1.0f, NextSlot);
+	return false;
+}
+
+void UPointDatasetLoadAction::BroadcastProgress(float Progress)
+{
+	//Once per visible step, not every frame
+	if (Progress - LastProgress >= 0.01f)
+	{
+		LastProgress = Progress;
+		OnProgress.Broadcast(Progress, NextSlot);
+	}
+}
+
+void UPointDatasetLoadAction::Finish()
+{
+	EndLoad();
+	SetReadyToDestroy();
+}
+
+void UPointDatasetLoadAction::EndLoad()
+{
+	bFinished = true;
+	if (State)
+	{
+		State->Progress.bCancelled = true;
+	}
+
+	//Removing the ticker from its own Tick is fine, Tick returns false right after anyway
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	TickerHandle.Reset();
+	FWorldDelegates::OnWorldCleanup.Remove(WorldCleanupHandle);
+	WorldCleanupHandle.Reset();
+
+	//Even when the component is being destroyed with its world, so NumBulkLoads stays balanced
+	if (bAdding)
+	{
+		bAdding = false;
+		if (UHInstancedPointComponent* Target = Component.Get(true))
+		{
+			Target->EndBulkLoad();
+		}
+	}
+	Dataset.Reset();
+	PointType = nullptr;
+}
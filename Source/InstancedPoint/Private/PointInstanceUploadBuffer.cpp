@@ -0,0 +1,291 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointInstanceUploadBuffer.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "HAL/IConsoleManager.h"
+#include "InstancedStaticMesh.h"
+
+void FPointInstanceUploadBuffer::Reset(int32 NumInstances)
+{
+	Submitted.Reset();
+	Submitted.SetNum(NumInstances);
+	StagedTransforms.Reset();
+	StagedCustomData.Reset();
+	bTransformsSorted = true;
+	bCustomDataSorted = true;
+	DirtyRanges.Reset();
+}
+
+void FPointInstanceUploadBuffer::Stage(int32 InstIndex, const FTransform& WorldTransform)
+{
+	if (!Submitted.IsValidIndex(InstIndex))
+	{
+		return;
+	}
+
+	const FInstanceState& Sent = Submitted[InstIndex];
+	if (Sent.Scale == WorldTransform.GetScale3D().X && Sent.Rotation.Equals(WorldTransform.GetRotation(), 0.0f))
+	{
+		return;
+	}
+
+	bTransformsSorted &= StagedTransforms.Num() == 0 || StagedTransforms.Last().InstIndex <= InstIndex;
+	StagedTransforms.Add({ InstIndex, WorldTransform });
+}
+
+void FPointInstanceUploadBuffer::StageCustomData(int32 InstIndex, int32 DataIndex, float Value)
+{
+	bCustomDataSorted &= StagedCustomData.Num() == 0 || StagedCustomData.Last().InstIndex <= InstIndex;
+	StagedCustomData.Add({ InstIndex, DataIndex, Value });
+}
+
+void FPointInstanceUploadBuffer::CoalesceStaged()
+{
+	//Stable, a later write to the same instance still wins
+	if (!bTransformsSorted)
+	{
+		StagedTransforms.StableSort([](const FStagedTransform& A, const FStagedTransform& B) { return A.InstIndex < B.InstIndex; });
+		bTransformsSorted = true;
+	}
+	if (!bCustomDataSorted)
+	{
+		StagedCustomData.StableSort([](const FStagedCustomData& A, const FStagedCustomData& B) { return A.InstIndex < B.InstIndex; });
+		bCustomDataSorted = true;
+	}
+
+	//Merge walk of both lists, an instance next to the last range extends it
+	DirtyRanges.Reset();
+	int32 t = 0;
+	int32 c = 0;
+	while (t < StagedTransforms.Num() || c < StagedCustomData.Num())
+	{
+		const int32 TransformIndex = t < StagedTransforms.Num() ? StagedTransforms[t].InstIndex : MAX_int32;
+		const int32 CustomDataIndex = c < StagedCustomData.Num() ? StagedCustomData[c].InstIndex : MAX_int32;
+		const int32 InstIndex = FMath::Min(TransformIndex, CustomDataIndex);
+		while (t < StagedTransforms.Num() && StagedTransforms[t].InstIndex == InstIndex)
+		{
+			t++;
+		}
+		while (c < StagedCustomData.Num() && StagedCustomData[c].InstIndex == InstIndex)
+		{
+			c++;
+		}
+
+		if (DirtyRanges.Num() > 0 && DirtyRanges.Last().End == InstIndex)
+		{
+			DirtyRanges.Last().End++;
+		}
+		else
+		{
+			DirtyRanges.Add({ InstIndex, InstIndex + 1 });
+		}
+	}
+}
+
+int32 FPointInstanceUploadBuffer::Submit(UInstancedStaticMeshComponent& Component)
+{
+	if (StagedTransforms.Num() == 0 && StagedCustomData.Num() == 0)
+	{
+		DirtyRanges.Reset();
+		return 0;
+	}
+
+	CoalesceStaged();
+
+	const FTransform& ComponentTransform = Component.GetComponentTransform();
+	const int32 NumCustomDataFloats = Component.NumCustomDataFloats;
+	const bool bHasCustomData = NumCustomDataFloats > 0 && Component.PerInstanceSMCustomData.Num() == Component.PerInstanceSMData.Num() * NumCustomDataFloats;
+	FInstanceUpdateCmdBuffer Commands;
+	int32 NumSent = 0;
+	int32 t = 0;
+	int32 c = 0;
+
+	for (const FInstanceRange& Range : DirtyRanges)
+	{
+		for (int32 InstIndex = Range.Start; InstIndex < Range.End; InstIndex++)
+		{
+			const bool bValidInstance = Component.PerInstanceSMData.IsValidIndex(InstIndex);
+			const int32 RenderIndex = Component.InstanceReorderTable.IsValidIndex(InstIndex) ? Component.InstanceReorderTable[InstIndex] : InstIndex;
+
+			//Only the last write of an instance is sent
+			const FStagedTransform* Staged = nullptr;
+			while (t < StagedTransforms.Num() && StagedTransforms[t].InstIndex == InstIndex)
+			{
+				Staged = &StagedTransforms[t++];
+			}
+			if (Staged && bValidInstance)
+			{
+				//Game thread copy stays in sync, a later render state rebuild reads it
+				const FMatrix LocalTransform = Staged->Transform.GetRelativeTransform(ComponentTransform).ToMatrixWithScale();
+				Component.PerInstanceSMData[InstIndex].Transform = LocalTransform;
+				if (RenderIndex != INDEX_NONE)
+				{
+					Commands.UpdateInstance(RenderIndex, LocalTransform);
+				}
+
+				FInstanceState& Sent = Submitted[InstIndex];
+				Sent.Rotation = Staged->Transform.GetRotation();
+				Sent.Scale = Staged->Transform.GetScale3D().X;
+			}
+
+			bool bCustomDataChanged = false;
+			for (; c < StagedCustomData.Num() && StagedCustomData[c].InstIndex == InstIndex; c++)
+			{
+				const FStagedCustomData& Value = StagedCustomData[c];
+				if (bValidInstance && bHasCustomData && Value.DataIndex >= 0 && Value.DataIndex < NumCustomDataFloats)
+				{
+					Component.PerInstanceSMCustomData[InstIndex * NumCustomDataFloats + Value.DataIndex] = Value.Value;
+					bCustomDataChanged = true;
+				}
+			}
+			if (bCustomDataChanged && RenderIndex != INDEX_NONE)
+			{
+				//The render data takes every float of the instance
+				CustomDataScratch.Reset();
+				CustomDataScratch.Append(Component.PerInstanceSMCustomData.GetData() + InstIndex * NumCustomDataFloats, NumCustomDataFloats);
+				Commands.SetCustomData(RenderIndex, CustomDataScratch);
+			}
+
+			NumSent += (Staged || bCustomDataChanged) && bValidInstance ? 1 : 0;
+		}
+	}
+
+	if (Commands.NumTotalCommands() > 0 && Component.PerInstanceRenderData.IsValid())
+	{
+		Component.PerInstanceRenderData->UpdateFromCommandBuffer(Commands);
+	}
+
+	StagedTransforms.Reset();
+	StagedCustomData.Reset();
+	return NumSent;
+}
+
+bool FPointInstanceUploadBuffer::CanSubmit(const UInstancedStaticMeshComponent& Component)
+{
+	return Component.PerInstanceRenderData.IsValid() && Component.IsRenderStateCreated() && !Component.IsRenderStateDirty();
+}
+
+//ip.VerifyInstanceUpload [NumRounds]
+//Stages random transforms and custom data on a transient component, no world or render data needed (runs with -nullrhi),
+//and checks the written instance data and the coalesced ranges against a plain per instance replay
+static void VerifyInstanceUpload(const TArray<FString>& Args)
+{
+	const int32 NumRounds = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 100;
+	const int32 NumInstances = 1000;
+	const int32 NumCustomDataFloats = 2;
+
+	UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(GetTransientPackage());
+	Component->NumCustomDataFloats = NumCustomDataFloats;
+	Component->PerInstanceSMData.SetNum(NumInstances);
+	Component->PerInstanceSMCustomData.SetNumZeroed(NumInstances * NumCustomDataFloats);
+
+	TArray<FMatrix> ExpectedTransforms;
+	TArray<float> ExpectedCustomData;
+	for (int32 i = 0; i < NumInstances; i++)
+	{
+		Component->PerInstanceSMData[i].Transform = FMatrix::Identity;
+		ExpectedTransforms.Add(FMatrix::Identity);
+	}
+	ExpectedCustomData.SetNumZeroed(NumInstances * NumCustomDataFloats);
+
+	FPointInstanceUploadBuffer Buffer;
+	Buffer.Reset(NumInstances);
+	FRandomStream Random(NumRounds);
+	//Zero scale until sent
+	TArray<FTransform> SentTransforms;
+	SentTransforms.Init(FTransform(FQuat::Identity, FVector::ZeroVector, FVector::ZeroVector), NumInstances);
+	int32 NumErrors = 0;
+	int32 NumRanges = 0;
+	int32 NumSkipped = 0;
+
+	for (int32 Round = 0; Round < NumRounds && NumErrors == 0; Round++)
+	{
+		TBitArray<> Dirty(false, NumInstances);
+
+		//Runs of instances, staged in random order, some of them twice
+		const int32 NumRuns = Random.RandRange(1, 20);
+		for (int32 Run = 0; Run < NumRuns; Run++)
+		{
+			const int32 Start = Random.RandRange(0, NumInstances - 1);
+			const int32 End = FMath::Min(Start + Random.RandRange(1, 40), NumInstances);
+			for (int32 i = Start; i < End; i++)
+			{
+				if (Random.FRand() < 0.7f)
+				{
+					const FTransform Transform(FRotator(Random.FRandRange(-90.0f, 90.0f), Random.FRandRange(-180.0f, 180.0f), 0.0f), FVector(i, 0.0f, 0.0f), FVector(Random.FRandRange(0.01f, 10.0f)));
+					const int32 NumBefore = Buffer.NumStaged();
+					Buffer.Stage(i, Transform);
+					if (Buffer.NumStaged() > NumBefore)
+					{
+						ExpectedTransforms[i] = Transform.ToMatrixWithScale();
+						SentTransforms[i] = Transform;
+						Dirty[i] = true;
+					}
+				}
+				else
+				{
+					const int32 DataIndex = Random.RandRange(0, NumCustomDataFloats - 1);
+					const float Value = Random.FRand() < 0.5f ? 0.0f : 1.0f;
+					Buffer.StageCustomData(i, DataIndex, Value);
+					ExpectedCustomData[i * NumCustomDataFloats + DataIndex] = Value;
+					Dirty[i] = true;
+				}
+			}
+		}
+
+		//What was last sent is dropped
+		const int32 Resent = Random.RandRange(0, NumInstances - 1);
+		if (!Dirty[Resent] && SentTransforms[Resent].GetScale3D().X > 0.0f)
+		{
+			const int32 NumBefore = Buffer.NumStaged();
+			Buffer.Stage(Resent, SentTransforms[Resent]);
+			NumSkipped += Buffer.NumStaged() == NumBefore ? 1 : 0;
+			NumErrors += Buffer.NumStaged() == NumBefore ? 0 : 1;
+		}
+
+		const int32 NumSent = Buffer.Submit(*Component);
+
+		int32 NumDirty = 0;
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			NumDirty += Dirty[i] ? 1 : 0;
+			NumErrors += Component->PerInstanceSMData[i].Transform.Equals(ExpectedTransforms[i], 1e-3f) ? 0 : 1;
+		}
+		for (int32 d = 0; d < ExpectedCustomData.Num(); d++)
+		{
+			NumErrors += Component->PerInstanceSMCustomData[d] == ExpectedCustomData[d] ? 0 : 1;
+		}
+		NumErrors += NumSent == NumDirty ? 0 : 1;
+
+		//Ranges cover exactly the dirty instances, in order, and never touch
+		int32 Covered = 0;
+		int32 LastEnd = -1;
+		for (const FPointInstanceUploadBuffer::FInstanceRange& Range : Buffer.GetSubmittedRanges())
+		{
+			NumErrors += Range.Start > LastEnd && Range.End > Range.Start ? 0 : 1;
+			for (int32 i = Range.Start; i < Range.End; i++)
+			{
+				NumErrors += Dirty.IsValidIndex(i) && Dirty[i] ? 0 : 1;
+			}
+			Covered += Range.End - Range.Start;
+			LastEnd = Range.End;
+			NumRanges++;
+		}
+		NumErrors += Covered == NumDirty ? 0 : 1;
+	}
+
+	if (NumErrors == 0)
+	{
+		UE_LOG(LogTemp, Display, TEXT("VerifyInstanceUpload passed: %d rounds, %d ranges, %d unchanged transforms dropped"), NumRounds, NumRanges, NumSkipped);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("VerifyInstanceUpload failed: %d mismatches"), NumErrors);
+	}
+}
+
+static FAutoConsoleCommand VerifyInstanceUploadCommand(
+	TEXT("ip.VerifyInstanceUpload"),
+	TEXT("Check FPointInstanceUploadBuffer staging, range coalescing and writes on a transient component. Args: number of rounds, default 100."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&VerifyInstanceUpload));
@@ -0,0 +1,390 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointJsonStream.h"
+#include "Serialization/Archive.h"
+#include "Misc/Parse.h"
+
+FPointJsonStream::FPointJsonStream(FArchive& InArchive, int32 BufferSize)
+	: Archive(InArchive)
+{
+	Buffer.SetNumUninitialized(FMath::Max(BufferSize, 1024));
+	BufferOffset = Archive.Tell();
+
+	//Byte order mark
+	if (PeekByte() == 0xEF)
+	{
+		BufferPos++;
+		if (ReadByte() != 0xBB || ReadByte() != 0xBF)
+		{
+			Fail();
+		}
+	}
+}
+
+int32 FPointJsonStream::RefillAndPeek()
+{
+	BufferOffset += BufferEnd;
+	BufferPos = 0;
+	BufferEnd = 0;
+
+	const int64 Remaining = Archive.TotalSize() - BufferOffset;
+	if (bError || Remaining <= 0)
+	{
+		return -1;
+	}
+
+	BufferEnd = (int32)FMath::Min<int64>(Remaining, Buffer.Num());
+	Archive.Serialize(Buffer.GetData(), BufferEnd);
+	if (Archive.IsError())
+	{
+		BufferEnd = 0;
+		Fail();
+		return -1;
+	}
+	return Buffer[0];
+}
+
+int32 FPointJsonStream::PeekToken()
+{
+	int32 Byte = PeekByte();
+	while (Byte == ' ' || Byte == '\n' || Byte == '\r' || Byte == '\t')
+	{
+		BufferPos++;
+		Byte = PeekByte();
+	}
+	return Byte;
+}
+
+bool FPointJsonStream::Fail()
+{
+	bError = true;
+	return false;
+}
+
+bool FPointJsonStream::BeginObject()
+{
+	if (bError || PeekToken() != '{')
+	{
+		return Fail();
+	}
+	BufferPos++;
+	FirstMember.Add(true);
+	return true;
+}
+
+bool FPointJsonStream::NextMember()
+{
+	if (bError || FirstMember.Num() == 0)
+	{
+		return Fail();
+	}
+
+	int32 Byte = PeekToken();
+	if (Byte == '}')
+	{
+		BufferPos++;
+		FirstMember.Pop(false);
+		return false;
+	}
+
+	if (!FirstMember.Last())
+	{
+		if (Byte != ',')
+		{
+			return Fail();
+		}
+		BufferPos++;
+		Byte = PeekToken();
+	}
+	FirstMember.Last() = false;
+
+	if (Byte != '"' || !ReadRawString(Key) || PeekToken() != ':')
+	{
+		return Fail();
+	}
+	BufferPos++;
+	return true;
+}
+
+bool FPointJsonStream::IsKey(const ANSICHAR* Name) const
+{
+	return Key.Num() > 0 && FCStringAnsi::Strcmp(Key.GetData(), Name) == 0;
+}
+
+bool FPointJsonStream::GetKeyAsIndex(int32& OutIndex) const
+{
+	if (Key.Num() < 2 || Key.Num() > 11)
+	{
+		return false;
+	}
+
+	int64 Index = 0;
+	for (int32 i = 0; i < Key.Num() - 1; i++)
+	{
+		if (Key[i] < '0' || Key[i] > '9')
+		{
+			return false;
+		}
+		Index = Index * 10 + (Key[i] - '0');
+	}
+	if (Index > MAX_int32)
+	{
+		return false;
+	}
+	OutIndex = (int32)Index;
+	return true;
+}
+
+FString FPointJsonStream::GetKeyString() const
+{
+	return Key.Num() > 0 ? FString(UTF8_TO_TCHAR(Key.GetData())) : FString();
+}
+
+bool FPointJsonStream::IsObjectNext()
+{
+	return !bError && PeekToken() == '{';
+}
+
+bool FPointJsonStream::ReadNumber(double& OutNumber)
+{
+	if (bError)
+	{
+		return false;
+	}
+
+	const int32 Byte = PeekToken();
+	if (Byte == '{' || Byte == '[')
+	{
+		SkipValue();
+		return false;
+	}
+	if (Byte == '"')
+	{
+		if (!ReadRawString(Scratch) || !FCStringAnsi::IsNumeric(Scratch.GetData()))
+		{
+			return false;
+		}
+	}
+	else if (!ReadRawLiteral(Scratch))
+	{
+		return false;
+	}
+	else if (Scratch[0] != '-' && (Scratch[0] < '0' || Scratch[0] > '9'))
+	{
+		//true, false or null
+		return false;
+	}
+
+	OutNumber = FCStringAnsi::Atod(Scratch.GetData());
+	return true;
+}
+
+bool FPointJsonStream::ReadString(FString& OutString)
+{
+	if (bError)
+	{
+		return false;
+	}
+
+	const int32 Byte = PeekToken();
+	if (Byte == '{' || Byte == '[')
+	{
+		SkipValue();
+		return false;
+	}
+	if (Byte == '"' ? !ReadRawString(Scratch) : !ReadRawLiteral(Scratch))
+	{
+		return false;
+	}
+	OutString = UTF8_TO_TCHAR(Scratch.GetData());
+	return true;
+}
+
+bool FPointJsonStream::SkipValue()
+{
+	if (bError)
+	{
+		return false;
+	}
+
+	const int32 Byte = PeekToken();
+	if (Byte == '"')
+	{
+		return SkipString();
+	}
+	if (Byte != '{' && Byte != '[')
+	{
+		return ReadRawLiteral(Scratch);
+	}
+
+	//Only brackets and strings matter inside, nothing is decoded
+	int32 Depth = 0;
+	do
+	{
+		const int32 Next = PeekByte();
+		if (Next == '"')
+		{
+			if (!SkipString())
+			{
+				return false;
+			}
+			continue;
+		}
+		if (Next < 0)
+		{
+			return Fail();
+		}
+		BufferPos++;
+		if (Next == '{' || Next == '[')
+		{
+			Depth++;
+		}
+		else if (Next == '}' || Next == ']')
+		{
+			Depth--;
+		}
+	} while (Depth > 0);
+	return true;
+}
+
+bool FPointJsonStream::SkipString()
+{
+	//Opening quote
+	BufferPos++;
+	for (;;)
+	{
+		const int32 Byte = ReadByte();
+		if (Byte == '"')
+		{
+			return true;
+		}
+		if (Byte == '\\')
+		{
+			ReadByte();
+		}
+		else if (Byte < 0)
+		{
+			return Fail();
+		}
+	}
+}
+
+bool FPointJsonStream::ReadRawLiteral(TArray<ANSICHAR>& OutLiteral)
+{
+	OutLiteral.Reset();
+	for (int32 Byte = PeekToken(); Byte >= 0; Byte = PeekByte())
+	{
+		if (Byte == ',' || Byte == '}' || Byte == ']' || Byte == ' ' || Byte == '\n' || Byte == '\r' || Byte == '\t')
+		{
+			break;
+		}
+		OutLiteral.Add((ANSICHAR)Byte);
+		BufferPos++;
+	}
+	if (OutLiteral.Num() == 0)
+	{
+		return Fail();
+	}
+	OutLiteral.Add('\0');
+	return true;
+}
+
+bool FPointJsonStream::ReadRawString(TArray<ANSICHAR>& OutString)
+{
+	OutString.Reset();
+
+	//Opening quote
+	BufferPos++;
+	for (;;)
+	{
+		int32 Byte = ReadByte();
+		if (Byte == '"')
+		{
+			break;
+		}
+		if (Byte < 0)
+		{
+			return Fail();
+		}
+		if (Byte != '\\')
+		{
+			OutString.Add((ANSICHAR)Byte);
+			continue;
+		}
+
+		Byte = ReadByte();
+		switch (Byte)
+		{
+		case '"': case '\\': case '/': OutString.Add((ANSICHAR)Byte); break;
+		case 'b': OutString.Add('\b'); break;
+		case 'f': OutString.Add('\f'); break;
+		case 'n': OutString.Add('\n'); break;
+		case 'r': OutString.Add('\r'); break;
+		case 't': OutString.Add('\t'); break;
+		case 'u':
+		{
+			auto ReadHex4 = [this]() -> int32
+			{
+				int32 Value = 0;
+				for (int32 i = 0; i < 4; i++)
+				{
+					const int32 Digit = ReadByte();
+					if (Digit < 0 || !FChar::IsHexDigit((TCHAR)Digit))
+					{
+						return -1;
+					}
+					Value = Value * 16 + FParse::HexDigit((TCHAR)Digit);
+				}
+				return Value;
+			};
+
+			int32 CodePoint = ReadHex4();
+			if (CodePoint < 0)
+			{
+				return Fail();
+			}
+			//Surrogate pair
+			if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF && PeekByte() == '\\')
+			{
+				BufferPos++;
+				const int32 Low = ReadByte() == 'u' ? ReadHex4() : -1;
+				if (Low < 0xDC00 || Low > 0xDFFF)
+				{
+					return Fail();
+				}
+				CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (Low - 0xDC00);
+			}
+
+			if (CodePoint < 0x80)
+			{
+				OutString.Add((ANSICHAR)CodePoint);
+			}
+			else if (CodePoint < 0x800)
+			{
+				OutString.Add((ANSICHAR)(0xC0 | (CodePoint >> 6)));
+				OutString.Add((ANSICHAR)(0x80 | (CodePoint & 0x3F)));
+			}
+			else if (CodePoint < 0x10000)
+			{
+				OutString.Add((ANSICHAR)(0xE0 | (CodePoint >> 12)));
+				OutString.Add((ANSICHAR)(0x80 | ((CodePoint >> 6) & 0x3F)));
+				OutString.Add((ANSICHAR)(0x80 | (CodePoint & 0x3F)));
+			}
+			else
+			{
+				OutString.Add((ANSICHAR)(0xF0 | (CodePoint >> 18)));
+				OutString.Add((ANSICHAR)(0x80 | ((CodePoint >> 12) & 0x3F)));
+				OutString.Add((ANSICHAR)(0x80 | ((CodePoint >> 6) & 0x3F)));
+				OutString.Add((ANSICHAR)(0x80 | (CodePoint & 0x3F)));
+			}
+			break;
+		}
+		default:
+			return Fail();
+		}
+	}
+
+	OutString.Add('\0');
+	return true;
+}
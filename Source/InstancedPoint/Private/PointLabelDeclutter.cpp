@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointLabelDeclutter.h"
+
+//Keeps the occupancy grid small for tiny cell sizes on large screens
+static const int32 MaxCellsPerAxis = 1024;
+
+void FPointLabelDeclutter::Reset()
+{
+	Mins.Reset();
+	Sizes.Reset();
+	Buckets.Reset();
+}
+
+int32 FPointLabelDeclutter::AddCandidate(const FVector2D& Min, const FVector2D& Size, float Priority)
+{
+	Mins.Add(Min);
+	Sizes.Add(Size);
+	//Bucket b holds priorities in (b / N, (b + 1) / N], so the top one starts just above (N - 1) / N
+	return Buckets.Add((uint8)FMath::Clamp(FMath::CeilToInt(Priority * NumPriorityBuckets) - 1, 0, NumPriorityBuckets - 1));
+}
+
+void FPointLabelDeclutter::Place(const FVector2D& ScreenSize, float CellSize, int32 Budget, TArray<int32>& OutPlaced)
+{
+	OutPlaced.Reset();
+
+	const int32 Num = Mins.Num();
+	if (Num == 0 || ScreenSize.X <= 0.0f || ScreenSize.Y <= 0.0f)
+	{
+		return;
+	}
+
+	//Counting sort, highest bucket first and candidate order within a bucket
+	BucketStart.Init(0, NumPriorityBuckets + 1);
+	for (int32 i = 0; i < Num; i++)
+	{
+		BucketStart[NumPriorityBuckets - 1 - Buckets[i] + 1]++;
+	}
+	for (int32 b = 0; b < NumPriorityBuckets; b++)
+	{
+		BucketStart[b + 1] += BucketStart[b];
+	}
+	Order.SetNumUninitialized(Num, false);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Order[BucketStart[NumPriorityBuckets - 1 - Buckets[i]]++] = i;
+	}
+
+	CellSize = FMath::Max3(CellSize, 1.0f, FMath::Max(ScreenSize.X, ScreenSize.Y) / MaxCellsPerAxis);
+	InvCellSize = 1.0f / CellSize;
+	NumCellsX = FMath::CeilToInt(ScreenSize.X * InvCellSize);
+	NumCellsY = FMath::CeilToInt(ScreenSize.Y * InvCellSize);
+	Occupied.Init(false, NumCellsX * NumCellsY);
+
+	for (int32 Slot : Order)
+	{
+		if (Budget > 0 && OutPlaced.Num() >= Budget)
+		{
+			break;
+		}
+		if (TryOccupy(Mins[Slot], Sizes[Slot]))
+		{
+			OutPlaced.Add(Slot);
+		}
+	}
+}
+
+bool FPointLabelDeclutter::TryOccupy(const FVector2D& Min, const FVector2D& Size)
+{
+	const int32 MinX = FMath::Max(FMath::FloorToInt(Min.X * InvCellSize), 0);
+	const int32 MinY = FMath::Max(FMath::FloorToInt(Min.Y * InvCellSize), 0);
+	const int32 MaxX = FMath::Min(FMath::FloorToInt((Min.X + Size.X) * InvCellSize), NumCellsX - 1);
+	const int32 MaxY = FMath::Min(FMath::FloorToInt((Min.Y + Size.Y) * InvCellSize), NumCellsY - 1);
+	if (MinX > MaxX || MinY > MaxY)
+	{
+		return false;
+	}
+
+	for (int32 Y = MinY; Y <= MaxY; Y++)
+	{
+		for (int32 X = MinX; X <= MaxX; X++)
+		{
+			if (Occupied[Y * NumCellsX + X])
+			{
+				return false;
+			}
+		}
+	}
+
+	for (int32 Y = MinY; Y <= MaxY; Y++)
+	{
+		for (int32 X = MinX; X <= MaxX; X++)
+		{
+			Occupied[Y * NumCellsX + X] = true;
+		}
+	}
+	return true;
+}
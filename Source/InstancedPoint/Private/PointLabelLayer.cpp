@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointLabelLayer.h"
+#include "SPointLabelLayer.h"
+#include "HInstancedPointComponent.h"
+
+#define LOCTEXT_NAMESPACE "InstancedPoint"
+
+UPointLabelLayer::UPointLabelLayer(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	Font = FCoreStyle::GetDefaultFontStyle("Regular", 10);
+	Visibility = ESlateVisibility::HitTestInvisible;
+}
+
+void UPointLabelLayer::AddPointComponent(UHInstancedPointComponent* Component)
+{
+	if (Component)
+	{
+		PointComponents.AddUnique(Component);
+		if (LabelLayer.IsValid())
+		{
+			LabelLayer->AddPointComponent(Component);
+		}
+	}
+}
+
+void UPointLabelLayer::RemovePointComponent(UHInstancedPointComponent* Component)
+{
+	PointComponents.Remove(Component);
+	if (LabelLayer.IsValid())
+	{
+		LabelLayer->RemovePointComponent(Component);
+	}
+}
+
+int32 UPointLabelLayer::GetNumLabelsDrawn() const
+{
+	return LabelLayer.IsValid() ? LabelLayer->GetNumLabelsDrawn() : 0;
+}
+
+TSharedRef<SWidget> UPointLabelLayer::RebuildWidget()
+{
+	LabelLayer = SNew(SPointLabelLayer);
+
+	for (const TWeakObjectPtr<UHInstancedPointComponent>& Component : PointComponents)
+	{
+		LabelLayer->AddPointComponent(Component.Get());
+	}
+	return LabelLayer.ToSharedRef();
+}
+
+void UPointLabelLayer::SynchronizeProperties()
+{
+	Super::SynchronizeProperties();
+
+	if (LabelLayer.IsValid())
+	{
+		LabelLayer->SetFont(Font);
+		LabelLayer->SetColorAndOpacity(ColorAndOpacity, ShadowColorAndOpacity, ShadowOffset);
+		LabelLayer->SetPlacement(Pivot, ScreenOffset);
+		LabelLayer->SetMaxLabels(MaxLabels);
+		LabelLayer->SetDeclutter(bDeclutter, DeclutterCellSize);
+	}
+}
+
+void UPointLabelLayer::ReleaseSlateResources(bool bReleaseChildren)
+{
+	Super::ReleaseSlateResources(bReleaseChildren);
+
+	LabelLayer.Reset();
+}
+
+#if WITH_EDITOR
+const FText UPointLabelLayer::GetPaletteCategory()
+{
+	return LOCTEXT("InstancedPoint", "Instanced Point");
+}
+#endif
+
+#undef LOCTEXT_NAMESPACE
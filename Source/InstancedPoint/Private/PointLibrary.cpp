@@ -2,6 +2,13 @@
 
 
 #include "PointLibrary.h"
+#include "PointJsonStream.h"
+#include "PointDatasetCache.h"
+#include "PointBinaryDataset.h"
+#include "HInstancedPointComponent.h"
+#include "Algo/IsSorted.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformMemory.h"
 //#include "ImageUtils.h"
 //#include <algorithm>
 //#include "Misc/FileHelper.h"
@@ -87,31 +94,152 @@ bool UPointLibrary::load_area_infomap(FString _file_path, FString _obj_key, TArr
 {
 	InfoMap.Empty();
 
-	// check file exist
-	IFileManager& fm = IFileManager::Get();
-	if (!fm.FileExists(*_file_path))return false;
+	FPointDatasetPtr Dataset = FPointDatasetCache::Get().Find(_file_path);
+	const TMap<FString, FString>* AreaInfoMap = Dataset ? Dataset->InfoMaps.Find(_obj_key) : nullptr;
+	if (!AreaInfoMap)
+	{
+		return false;
+	}
+
+	for (const FString& each_key : _info_keys)
+	{
+		if (const FString* each_value = AreaInfoMap->Find(each_key))
+		{
+			InfoMap.Add(each_key, *each_value);
+		}
+	}
+
+	return true;
+}
 
-	// load json
-	TSharedPtr<FJsonObject>file_obj = MakeShareable(new FJsonObject());
-	TSharedPtr<FJsonObject>area_obj = MakeShareable(new FJsonObject());
-	load_json(_file_path, file_obj);
+//Transforms built in one pass and added with one call, so the cluster tree is built once
+static int32 PopulateFromPoints(UHInstancedPointComponent* Component, const FString& Type, TArrayView<const int32> PointIndices, TArrayView<const FVector> PointLocs, bool bClearInstances)
+{
+	if (bClearInstances)
+	{
+		Component->ClearInstances();
+	}
+	const int32 FirstInstance = Component->GetInstanceCount();
+	Component->SetType(Type);
+
+	TArray<FTransform> Transforms;
+	Transforms.Reserve(PointLocs.Num());
+	for (const FVector& PointLoc : PointLocs)
+	{
+		Transforms.Emplace(PointLoc);
+	}
 
-	// find info map
+	Component->PreAllocateInstancesMemory(Transforms.Num());
+	Component->AddInstances(Transforms, false);
+	Component->SetInstancePointIndices(FirstInstance, PointIndices);
+	if (Component->GetStaticMesh())
+	{
+		Component->SetBoundsSize();
+	}
+	return Transforms.Num();
+}
 
-	area_obj = file_obj->GetObjectField(_obj_key);
-	FString each_value;
-	for (FString each_key:_info_keys)
+int32 UPointLibrary::PopulatePointComponent(UHInstancedPointComponent* Component, FString Type, FString DataPath, bool bClearInstances)
+{
+	FPointDatasetPtr Dataset = Component ? FPointDatasetCache::Get().Find(DataPath) : nullptr;
+	const FPointDatasetType* PointType = Dataset ? Dataset->FindType(Type) : nullptr;
+	if (!PointType)
 	{
-		if (area_obj->GetObjectField("InfoMap")->TryGetStringField(each_key, each_value))
+		return 0;
+	}
+
+	return PopulateFromPoints(Component, Type, PointType->PointIndices, PointType->Locations, bClearInstances);
+}
+
+int32 UPointLibrary::PopulatePointComponentFromBinary(UHInstancedPointComponent* Component, FString Type, FString BinaryPath, bool bClearInstances)
+{
+	FPointBinaryDataset Dataset;
+	const int32 TypeId = Component && Dataset.Open(BinaryPath) ? Dataset.FindType(Type) : INDEX_NONE;
+	if (TypeId == INDEX_NONE)
+	{
+		return 0;
+	}
+
+	return PopulateFromPoints(Component, Type, Dataset.GetIndices(TypeId), Dataset.GetPositions(TypeId), bClearInstances);
+}
+
+bool UPointLibrary::ConvertPointDataToBinary(FString JsonPath, FString BinaryPath)
+{
+	//Not through the cache, a one off conversion should not push out the datasets in use
+	FPointDataset Dataset;
+	return Dataset.Load(JsonPath) && FPointBinaryDataset::Write(Dataset, BinaryPath);
+}
+
+TMap<int32, FVector> UPointLibrary::GetBinaryPointLocMap(FString Type, FString BinaryPath)
+{
+	TMap<int32, FVector> PointLocaMap;
+
+	FPointBinaryDataset Dataset;
+	const int32 TypeId = Dataset.Open(BinaryPath) ? Dataset.FindType(Type) : INDEX_NONE;
+	if (TypeId != INDEX_NONE)
+	{
+		const TArrayView<const int32> Indices = Dataset.GetIndices(TypeId);
+		const TArrayView<const FVector> Positions = Dataset.GetPositions(TypeId);
+		PointLocaMap.Reserve(Indices.Num());
+		for (int32 Slot = 0; Slot < Indices.Num(); Slot++)
 		{
-			InfoMap.Add(each_key,each_value);
+			PointLocaMap.Add(Indices[Slot], Positions[Slot]);
 		}
 	}
 
-	return true;
+	return PointLocaMap;
 }
 
-TMap<int32, FVector> UPointLibrary::GetPointLocMap(FString Type, FString DataPath)
+TMap<FString, FString> UPointLibrary::GetBinaryPointAttribute(FString Type, int32 Index, FString BinaryPath)
+{
+	FPointBinaryDataset Dataset;
+	const int32 TypeId = Dataset.Open(BinaryPath) ? Dataset.FindType(Type) : INDEX_NONE;
+	if (TypeId == INDEX_NONE)
+	{
+		return TMap<FString, FString>();
+	}
+
+	return Dataset.GetAttributeMap(TypeId, Dataset.FindSlot(TypeId, Index));
+}
+
+TMap<FString, FTypePointAtt> UPointLibrary::GetBinaryPointAttMap(FString BinaryPath)
+{
+	TMap<FString, FTypePointAtt> AllPointAttMap;
+
+	FPointBinaryDataset Dataset;
+	if (Dataset.Open(BinaryPath))
+	{
+		for (int32 TypeId = 0; TypeId < Dataset.GetNumTypes(); TypeId++)
+		{
+			const TArrayView<const int32> Indices = Dataset.GetIndices(TypeId);
+			TMap<int32, FPointAtt> TypePointAttMap;
+			TypePointAttMap.Reserve(Indices.Num());
+			for (int32 Slot = 0; Slot < Indices.Num(); Slot++)
+			{
+				TypePointAttMap.Add(Indices[Slot], FPointAtt(Dataset.GetAttributeMap(TypeId, Slot)));
+			}
+
+			const FUtf8StringView TypeName = Dataset.GetTypeName(TypeId);
+			const FUTF8ToTCHAR Converted((const ANSICHAR*)TypeName.GetData(), TypeName.Len());
+			AllPointAttMap.Add(FString(Converted.Length(), Converted.Get()), FTypePointAtt(TypePointAttMap));
+		}
+	}
+
+	return AllPointAttMap;
+}
+
+void UPointLibrary::EvictPointDataset(FString DataPath)
+{
+	FPointDatasetCache::Get().Evict(DataPath);
+}
+
+void UPointLibrary::ClearPointDatasetCache()
+{
+	FPointDatasetCache::Get().Empty();
+}
+
+//The whole file as a DOM, then one lookup per point. Kept to check and time ReadPointLocations against
+static TMap<int32, FVector> GetPointLocMapFromJsonObject(const FString& Type, const FString& DataPath)
 {
 	TMap<int32, FVector> PointLocaMap;
 
@@ -135,84 +263,225 @@ TMap<int32, FVector> UPointLibrary::GetPointLocMap(FString Type, FString DataPat
 		}
 
 		FileAr->Close();
+		delete FileAr;
 	}
 
 	return PointLocaMap;
 }
 
-TMap<FString, FString> UPointLibrary::GetPointAttribute(FString Type, int32 Index, FString DataPath)
+//Points in index order, as when they were looked up one by one
+static TMap<int32, FVector> MakePointLocMap(const TArray<int32>& PointIndices, const TArray<FVector>& PointLocs)
 {
-	TMap<FString, FString> PointAttMap;
+	TMap<int32, FVector> PointLocaMap;
 
-	FArchive* const FileAr = IFileManager::Get().CreateFileReader(*DataPath);
-	if (FileAr)
+	TArray<int32> Order;
+	Order.SetNumUninitialized(PointIndices.Num());
+	for (int32 i = 0; i < Order.Num(); i++)
 	{
-		TSharedPtr<FJsonObject> PointDataObject = MakeShareable(new FJsonObject);
-		TSharedRef<TJsonReader<TCHAR>> Reader = TJsonReaderFactory<TCHAR>::Create(FileAr);
-		FJsonSerializer::Deserialize(Reader, PointDataObject);
+		Order[i] = i;
+	}
+	if (!Algo::IsSorted(PointIndices))
+	{
+		Order.Sort([&PointIndices](int32 A, int32 B) { return PointIndices[A] < PointIndices[B]; });
+	}
 
-		if (PointDataObject)
+	PointLocaMap.Reserve(PointIndices.Num());
+	for (int32 i : Order)
+	{
+		PointLocaMap.Add(PointIndices[i], PointLocs[i]);
+	}
+	return PointLocaMap;
+}
+
+bool UPointLibrary::ReadPointLocations(const FString& Type, const FString& DataPath, TArray<int32>& OutIndices, TArray<FVector>& OutLocations)
+{
+	OutIndices.Reset();
+	OutLocations.Reset();
+
+	TUniquePtr<FArchive> FileAr(IFileManager::Get().CreateFileReader(*DataPath));
+	if (!FileAr)
+	{
+		return false;
+	}
+
+	//{Type: {Index: {"Loc": {..}, "Att": {..}}}}
+	const FTCHARToUTF8 TypeKey(*Type);
+	FPointJsonStream Stream(*FileAr);
+	if (!Stream.BeginObject())
+	{
+		return false;
+	}
+	while (Stream.NextMember())
+	{
+		if (!Stream.IsKey(TypeKey.Get()))
+		{
+			Stream.SkipValue();
+			continue;
+		}
+
+		if (!Stream.BeginObject())
 		{
-			TSharedPtr<FJsonObject> PointAtt = MakeShareable(new FJsonObject);
-			PointAtt = PointDataObject->GetObjectField(Type)->GetObjectField(FString::FromInt(Index))->GetObjectField(TEXT("Att"));
-			TArray<FString> Keys;
-			PointAtt->Values.GetKeys(Keys);
-			for (FString Key : Keys)
+			break;
+		}
+		while (Stream.NextMember())
+		{
+			int32 PointIndex = 0;
+			if (!Stream.GetKeyAsIndex(PointIndex) || !Stream.BeginObject())
+			{
+				Stream.SkipValue();
+				continue;
+			}
+
+			bool bHasLoc = false;
+			FVector PointLoc;
+			while (Stream.NextMember())
+			{
+				if (Stream.IsKey("Loc"))
+				{
+					bHasLoc = FPointDataset::ReadLoc(Stream, PointLoc);
+				}
+				else
+				{
+					Stream.SkipValue();
+				}
+			}
+			if (bHasLoc)
 			{
-				PointAttMap.Add(Key, PointAtt->GetStringField(Key));
+				OutIndices.Add(PointIndex);
+				OutLocations.Add(PointLoc);
 			}
 		}
 
-		FileAr->Close();
+		//The rest of the file holds other types
+		return !Stream.HasError();
 	}
+	return false;
+}
 
-	return PointAttMap;
+TMap<int32, FVector> UPointLibrary::GetPointLocMap(FString Type, FString DataPath)
+{
+	//A dataset someone already parsed is free, otherwise stream the one type instead of parsing the whole file,
+	//and keep what was streamed for the next call
+	if (FPointDatasetPtr Dataset = FPointDatasetCache::Get().FindCached(DataPath))
+	{
+		const FPointDatasetType* PointType = Dataset->FindType(Type);
+		return PointType ? MakePointLocMap(PointType->PointIndices, PointType->Locations) : TMap<int32, FVector>();
+	}
+
+	FPointTypeLocationsPtr Locations = FPointDatasetCache::Get().FindTypeLocations(DataPath, Type,
+		[&Type](const FString& FullPath, TArray<int32>& OutIndices, TArray<FVector>& OutLocations)
+		{
+			return ReadPointLocations(Type, FullPath, OutIndices, OutLocations);
+		});
+	return Locations ? MakePointLocMap(Locations->PointIndices, Locations->Locations) : TMap<int32, FVector>();
+}
+
+TMap<FString, FString> UPointLibrary::GetPointAttribute(FString Type, int32 Index, FString DataPath)
+{
+	FPointDatasetPtr Dataset = FPointDatasetCache::Get().Find(DataPath);
+	const FPointDatasetType* PointType = Dataset ? Dataset->FindType(Type) : nullptr;
+	if (!PointType)
+	{
+		return TMap<FString, FString>();
+	}
 
+	return PointType->GetAttributes(PointType->FindSlot(Index), Dataset->AttNames);
 }
 
 TMap<FString, FTypePointAtt> UPointLibrary::GetPointAttMap(FString DataPath)
 {
 	TMap<FString, FTypePointAtt> AllPointAttMap;
 
-	FArchive* const FileAr = IFileManager::Get().CreateFileReader(*DataPath);
-	if (FileAr)
+	FPointDatasetPtr Dataset = FPointDatasetCache::Get().Find(DataPath);
+	if (Dataset)
 	{
-		TSharedPtr<FJsonObject> PointDataObject = MakeShareable(new FJsonObject);
-		TSharedRef<TJsonReader<TCHAR>> Reader = TJsonReaderFactory<TCHAR>::Create(FileAr);
-		FJsonSerializer::Deserialize(Reader, PointDataObject);
-
-		if (PointDataObject)
+		for (const TPair<FString, FPointDatasetType>& Pair : Dataset->Types)
 		{
-			TArray<FString> Typekeys;
-			PointDataObject->Values.GetKeys(Typekeys);
-			for (FString TpyeKey : Typekeys)
-			{
-				TMap<int32, FPointAtt> TypePointAttMap;
+			const FPointDatasetType& PointType = Pair.Value;
 
-				int32 PointNum = PointDataObject->GetObjectField(TpyeKey)->Values.Num();
-				for (int32 PointIndex = 0; PointIndex < PointNum; PointIndex++)
-				{
-					TSharedPtr<FJsonObject> PointAttObj = MakeShareable(new FJsonObject);
-					PointAttObj = PointDataObject->GetObjectField(TpyeKey)->GetObjectField(FString::FromInt(PointIndex))->GetObjectField(TEXT("Att"));
-
-					TMap<FString, FString> PointAttMap;
-					TArray<FString> PointAttArray;
-					PointAttObj->Values.GetKeys(PointAttArray);
-					for (FString PointAttKey : PointAttArray)
-					{
-						PointAttMap.Add(PointAttKey, PointAttObj->GetStringField(PointAttKey));
-					}
-					FPointAtt PointAtt =  FPointAtt(PointAttMap);
-
-					TypePointAttMap.Add(PointIndex, PointAtt);
-				}
-				FTypePointAtt TypePointAtt = FTypePointAtt(TypePointAttMap);
-				AllPointAttMap.Add(TpyeKey, TypePointAtt);
+			TMap<int32, FPointAtt> TypePointAttMap;
+			TypePointAttMap.Reserve(PointType.Num());
+			for (int32 Slot = 0; Slot < PointType.Num(); Slot++)
+			{
+				TypePointAttMap.Add(PointType.PointIndices[Slot], FPointAtt(PointType.GetAttributes(Slot, Dataset->AttNames)));
 			}
+			TypePointAttMap.KeySort(TLess<int32>());
+			AllPointAttMap.Add(Pair.Key, FTypePointAtt(TypePointAttMap));
 		}
+	}
 
-		FileAr->Close();
+	return AllPointAttMap;
+}
+
+//ip.BenchmarkPointLoad DataPath Type
+//Loads the locations of Type through GetPointLocMap with nothing cached and with the DOM, logs time and memory of both and whether they match
+static void BenchmarkPointLoad(const TArray<FString>& Args)
+{
+	if (Args.Num() < 2)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Usage: ip.BenchmarkPointLoad DataPath Type"));
+		return;
+	}
+	const FString& DataPath = Args[0];
+	const FString& Type = Args[1];
+
+	//Cold, as on the first call. Streaming first, the process peak only grows
+	FPointDatasetCache::Get().Evict(DataPath);
+	uint64 PeakBefore = FPlatformMemory::GetStats().PeakUsedPhysical;
+	double StartTime = FPlatformTime::Seconds();
+	const TMap<int32, FVector> StreamedMap = UPointLibrary::GetPointLocMap(Type, DataPath);
+	const double StreamTime = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+	const uint64 StreamPeak = FPlatformMemory::GetStats().PeakUsedPhysical - PeakBefore;
+
+	PeakBefore = FPlatformMemory::GetStats().PeakUsedPhysical;
+	StartTime = FPlatformTime::Seconds();
+	const TMap<int32, FVector> DomMap = GetPointLocMapFromJsonObject(Type, DataPath);
+	const double DomTime = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+	const uint64 DomPeak = FPlatformMemory::GetStats().PeakUsedPhysical - PeakBefore;
+
+	int32 NumMismatches = FMath::Abs(StreamedMap.Num() - DomMap.Num());
+	for (const TPair<int32, FVector>& Pair : DomMap)
+	{
+		const FVector* Streamed = StreamedMap.Find(Pair.Key);
+		NumMismatches += (!Streamed || !Streamed->Equals(Pair.Value, KINDA_SMALL_NUMBER)) ? 1 : 0;
 	}
 
-	return  AllPointAttMap;
-}
\ No newline at end of file
+	UE_LOG(LogTemp, Display, TEXT("BenchmarkPointLoad %s: %d points, stream %.1f ms (peak +%.1f MB), DOM %.1f ms (peak +%.1f MB), %d mismatches"),
+		*Type, StreamedMap.Num(), StreamTime, StreamPeak / (1024.0 * 1024.0), DomTime, DomPeak / (1024.0 * 1024.0), NumMismatches);
+}
+
+static FAutoConsoleCommand BenchmarkPointLoadCommand(
+	TEXT("ip.BenchmarkPointLoad"),
+	TEXT("Time GetPointLocMap against the former DOM loader. Args: data path, type."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkPointLoad));
+
+//ip.BenchmarkBinaryPointLoad BinaryPath Type
+//Maps a binary point file and copies the positions of Type out, as a component would to add its instances
+static void BenchmarkBinaryPointLoad(const TArray<FString>& Args)
+{
+	if (Args.Num() < 2)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Usage: ip.BenchmarkBinaryPointLoad BinaryPath Type"));
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	FPointBinaryDataset Dataset;
+	const int32 TypeId = Dataset.Open(Args[0]) ? Dataset.FindType(Args[1]) : INDEX_NONE;
+	const double OpenTime = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+	if (TypeId == INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("BenchmarkBinaryPointLoad: no type %s in %s"), *Args[1], *Args[0]);
+		return;
+	}
+
+	TArray<FVector> Positions(Dataset.GetPositions(TypeId));
+	const double CopyTime = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+	UE_LOG(LogTemp, Display, TEXT("BenchmarkBinaryPointLoad %s: %d points, open %.2f ms, positions copied at %.2f ms"), *Args[1], Positions.Num(), OpenTime, CopyTime);
+}
+
+static FAutoConsoleCommand BenchmarkBinaryPointLoadCommand(
+	TEXT("ip.BenchmarkBinaryPointLoad"),
+	TEXT("Time opening a binary point file and reading the positions of one type. Args: binary path, type."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBinaryPointLoad));
@@ -0,0 +1,39 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointLocationCache.h"
+#include "Components/InstancedStaticMeshComponent.h"
+
+void FPointLocationCache::Rebuild(const UInstancedStaticMeshComponent& Component, int32 VisibilityCustomDataIndex, float HiddenScale)
+{
+	const int32 InstanceCount = Component.PerInstanceSMData.Num();
+	X.SetNumUninitialized(InstanceCount);
+	Y.SetNumUninitialized(InstanceCount);
+	Z.SetNumUninitialized(InstanceCount);
+	AppliedScale.SetNumUninitialized(InstanceCount);
+
+	const FTransform& ComponentTransform = Component.GetComponentTransform();
+	const float ComponentScale = ComponentTransform.GetScale3D().X;
+	const int32 NumCustomDataFloats = Component.NumCustomDataFloats;
+	const bool bReadVisibility = VisibilityCustomDataIndex >= 0 && VisibilityCustomDataIndex < NumCustomDataFloats
+		&& Component.PerInstanceSMCustomData.Num() == InstanceCount * NumCustomDataFloats;
+
+	for (int32 i = 0; i < InstanceCount; i++)
+	{
+		//Only the origin and one axis length are read, no matrix decomposition
+		const FMatrix& InstanceMatrix = Component.PerInstanceSMData[i].Transform;
+		const FVector WorldLocation = ComponentTransform.TransformPosition(InstanceMatrix.GetOrigin());
+
+		X[i] = WorldLocation.X;
+		Y[i] = WorldLocation.Y;
+		Z[i] = WorldLocation.Z;
+		AppliedScale[i] = InstanceMatrix.GetScaledAxis(EAxis::X).Size() * ComponentScale;
+
+		if (bReadVisibility && Component.PerInstanceSMCustomData[i * NumCustomDataFloats + VisibilityCustomDataIndex] == 0.0f)
+		{
+			AppliedScale[i] = HiddenScale;
+		}
+	}
+
+	bDirty = false;
+}
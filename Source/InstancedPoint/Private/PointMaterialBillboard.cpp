@@ -0,0 +1,183 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointMaterialBillboard.h"
+#include "PointBillboardUpdate.h"
+#include "PointViewState.h"
+#include "Components/MeshComponent.h"
+#include "HAL/IConsoleManager.h"
+#include "Materials/MaterialInterface.h"
+
+float FPointMaterialBillboard::ScreenScale(const FVector& PointLocation, const FVector& CameraLocation, const FVector& CameraForward, float ProjectionScaleY, float ViewSizeY, float BaseSize, float ScreenSize)
+{
+	const float Depth = FMath::Max(FVector::DotProduct(PointLocation - CameraLocation, CameraForward), 1.0f);
+	return 2.0f * ScreenSize * Depth / FMath::Max(BaseSize * ProjectionScaleY * ViewSizeY, 1e-6f);
+}
+
+float FPointMaterialBillboard::CullingMask(float Distance, float PatternCullingDistance)
+{
+	return (PatternCullingDistance <= 0.0f || Distance < PatternCullingDistance) ? 1.0f : 0.0f;
+}
+
+FVector FPointMaterialBillboard::BillboardOffset(const FVector& LocalPosition, const FVector& CameraForward, const FVector& CameraUp, bool bLockZ, float Scale)
+{
+	FVector AxisY = -CameraForward;
+	FVector AxisZ = CameraUp;
+	if (bLockZ)
+	{
+		AxisY.Z = 0.0f;
+		AxisZ = FVector(0.0f, 0.0f, 1.0f);
+	}
+	AxisY *= FMath::InvSqrt(FMath::Max(AxisY.SizeSquared(), 1e-8f));
+	FVector AxisX = FVector::CrossProduct(AxisY, AxisZ);
+	AxisX *= FMath::InvSqrt(FMath::Max(AxisX.SizeSquared(), 1e-8f));
+	AxisZ = FVector::CrossProduct(AxisX, AxisY);
+
+	return Scale * (LocalPosition.X * AxisX + LocalPosition.Y * AxisY + LocalPosition.Z * AxisZ) - LocalPosition;
+}
+
+bool FPointMaterialBillboard::MaterialsReadVisibility(const UMeshComponent& Component)
+{
+	const int32 NumMaterials = Component.GetNumMaterials();
+	for (int32 i = 0; i < NumMaterials; i++)
+	{
+		const UMaterialInterface* Material = Component.GetMaterial(i);
+		float Value = 0.0f;
+		if (!Material || !Material->GetScalarParameterValue(FHashedMaterialParameterInfo(TEXT("IP_CustomDataVisibility")), Value))
+		{
+			return false;
+		}
+	}
+	return NumMaterials > 0;
+}
+
+FVector FPointMaterialBillboard::WorldPositionOffset(const FVector& LocalPosition, const FVector& PointLocation, float BaseSize, const FVector& CameraLocation, const FVector& CameraForward, const FVector& CameraUp, float ProjectionScaleY, float ViewSizeY, float ScreenSize, float PatternCullingDistance, float MaxScale, bool bLockZ)
+{
+	float Scale = ScreenScale(PointLocation, CameraLocation, CameraForward, ProjectionScaleY, ViewSizeY, BaseSize, ScreenSize);
+	if (MaxScale > 0.0f)
+	{
+		Scale = FMath::Min(Scale, MaxScale);
+	}
+	Scale *= CullingMask(FVector::Dist(PointLocation, CameraLocation), PatternCullingDistance);
+	return BillboardOffset(LocalPosition, CameraForward, CameraUp, bLockZ, Scale);
+}
+
+//ip.VerifyMaterialBillboard [NumSamples]
+//Compares the material formulas with the CPU billboard update on random cameras and points, logs the largest relative errors.
+//The whole World Position Offset is checked against FPointBillboardUpdate with a MaxScale limit and a culling distance
+static void VerifyMaterialBillboard(const TArray<FString>& Args)
+{
+	const int32 NumSamples = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 10000;
+	const FVector2D ViewportSize(1920.0f, 1080.0f);
+	const float ScreenSize = 10.0f;
+	const float Tolerance = 1e-3f;
+
+	FRandomStream Random(NumSamples);
+	float MaxScaleError = 0.0f;
+	float MaxOffsetError = 0.0f;
+	float MaxWPOError = 0.0f;
+	int32 NumTested = 0;
+	int32 NumClamped = 0;
+	int32 NumCulled = 0;
+
+	FPointLocationCache Cache;
+	const TArray<int32> Candidates = { 0 };
+	FPointBillboardChunkScratch Scratch;
+	FPointBillboardOutput Output;
+	Output.SetNum(1);
+
+	for (int32 Sample = 0; Sample < NumSamples; Sample++)
+	{
+		const FVector CameraLocation = Random.GetUnitVector() * Random.FRandRange(0.0f, 100000.0f);
+		const FRotator CameraRotation(Random.FRandRange(-85.0f, 85.0f), Random.FRandRange(-180.0f, 180.0f), 0.0f);
+		const float FOV = Random.FRandRange(30.0f, 110.0f);
+
+		FPointViewState View;
+		View.Init(CameraLocation, CameraRotation, FOV, ViewportSize);
+
+		//Inside the view, at the depth of a far or a near point
+		const float TanHalfFOV = FMath::Tan(FMath::DegreesToRadians(FOV * 0.5f));
+		const float Depth = Random.FRandRange(100.0f, 200000.0f);
+		const FRotationMatrix CameraAxes(CameraRotation);
+		const FVector PointLocation = CameraLocation
+			+ CameraAxes.GetScaledAxis(EAxis::X) * Depth
+			+ CameraAxes.GetScaledAxis(EAxis::Y) * Random.FRandRange(-0.9f, 0.9f) * TanHalfFOV * Depth
+			+ CameraAxes.GetScaledAxis(EAxis::Z) * Random.FRandRange(-0.9f, 0.9f) * TanHalfFOV * Depth * ViewportSize.Y / ViewportSize.X;
+		const float BaseSize = Random.FRandRange(10.0f, 500.0f);
+
+		//What the CPU update does: ScreenSize over the screen distance to the point raised by BaseSize
+		FVector2D ScreenLocation;
+		FVector2D RaisedScreenLocation;
+		if (!View.Projector.ProjectWorldToScreen(PointLocation, ScreenLocation) || !View.Projector.ProjectWorldToScreen(PointLocation + View.ControllerUp * BaseSize, RaisedScreenLocation))
+		{
+			continue;
+		}
+		const float ReferenceScale = ScreenSize / FMath::Max(FVector2D::Distance(ScreenLocation, RaisedScreenLocation), KINDA_SMALL_NUMBER);
+
+		const float ProjectionScaleY = (ViewportSize.X / ViewportSize.Y) / TanHalfFOV;
+		const float Scale = FPointMaterialBillboard::ScreenScale(PointLocation, View.CameraLocation, View.CameraForward, ProjectionScaleY, ViewportSize.Y, BaseSize, ScreenSize);
+		MaxScaleError = FMath::Max(MaxScaleError, FMath::Abs(Scale - ReferenceScale) / ReferenceScale);
+
+		const FVector LocalPosition = Random.GetUnitVector() * BaseSize;
+		for (int32 LockZ = 0; LockZ < 2; LockZ++)
+		{
+			const FRotator Rotator = FPointBillboardUpdate::MakeBillboardRotator(LockZ != 0, View.ControllerForward, View.ControllerUp);
+			const FVector ReferenceOffset = Rotator.RotateVector(LocalPosition) * ReferenceScale - LocalPosition;
+			const FVector Offset = FPointMaterialBillboard::BillboardOffset(LocalPosition, View.CameraForward, View.ControllerUp, LockZ != 0, ReferenceScale);
+			MaxOffsetError = FMath::Max(MaxOffsetError, (Offset - ReferenceOffset).Size() / (BaseSize * FMath::Max(ReferenceScale, 1.0f)));
+		}
+
+		//Half of the points clamped by MaxScale, half of them beyond the culling distance
+		const float Distance = FVector::Dist(PointLocation, View.CameraLocation);
+		const float MaxScale = ReferenceScale * (Random.FRand() < 0.5f ? Random.FRandRange(0.5f, 0.9f) : Random.FRandRange(1.1f, 2.0f));
+		const float PatternCullingDistance = Distance * (Random.FRand() < 0.5f ? 0.8f : 1.25f);
+
+		Cache.X = { PointLocation.X };
+		Cache.Y = { PointLocation.Y };
+		Cache.Z = { PointLocation.Z };
+		Cache.AppliedScale = { 1.0f };
+
+		FPointBillboardParams Params;
+		Params.CameraLocation = View.CameraLocation;
+		Params.UpOffset = View.ControllerUp * BaseSize;
+		Params.ScreenSize = ScreenSize;
+		Params.PatternCullingDistance = PatternCullingDistance;
+		Params.MaxScale = MaxScale;
+		FPointBillboardUpdate::ComputeRange(Params, View.Projector, Cache, Candidates, 0, 1, Scratch, Output);
+
+		//The CPU collapses culled points, the material scales them to 0
+		const EPointBillboardAction Action = (EPointBillboardAction)Output.Actions[0];
+		if (Action != EPointBillboardAction::Billboard && Action != EPointBillboardAction::Collapse)
+		{
+			continue;
+		}
+		const float CPUScale = Action == EPointBillboardAction::Billboard ? Output.Scales[0] : 0.0f;
+		NumClamped += MaxScale < ReferenceScale ? 1 : 0;
+		NumCulled += Action == EPointBillboardAction::Collapse ? 1 : 0;
+
+		for (int32 LockZ = 0; LockZ < 2; LockZ++)
+		{
+			const FRotator Rotator = FPointBillboardUpdate::MakeBillboardRotator(LockZ != 0, View.ControllerForward, View.ControllerUp);
+			const FVector ReferenceOffset = Rotator.RotateVector(LocalPosition) * CPUScale - LocalPosition;
+			const FVector Offset = FPointMaterialBillboard::WorldPositionOffset(LocalPosition, PointLocation, BaseSize, View.CameraLocation, View.CameraForward, View.ControllerUp,
+				ProjectionScaleY, ViewportSize.Y, ScreenSize, PatternCullingDistance, MaxScale, LockZ != 0);
+			MaxWPOError = FMath::Max(MaxWPOError, (Offset - ReferenceOffset).Size() / (BaseSize * FMath::Max(CPUScale, 1.0f)));
+		}
+		NumTested++;
+	}
+
+	const bool bPassed = NumTested > 0 && MaxScaleError < Tolerance && MaxOffsetError < Tolerance && MaxWPOError < Tolerance;
+	if (bPassed)
+	{
+		UE_LOG(LogTemp, Display, TEXT("VerifyMaterialBillboard passed: %d samples (%d clamped, %d culled), max scale error %g, max offset error %g, max WPO error %g"), NumTested, NumClamped, NumCulled, MaxScaleError, MaxOffsetError, MaxWPOError);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("VerifyMaterialBillboard failed: %d samples, max scale error %g, max offset error %g, max WPO error %g (tolerance %g)"), NumTested, MaxScaleError, MaxOffsetError, MaxWPOError, Tolerance);
+	}
+}
+
+static FAutoConsoleCommand VerifyMaterialBillboardCommand(
+	TEXT("ip.VerifyMaterialBillboard"),
+	TEXT("Check the material billboard formulas against the CPU billboard update. Args: number of samples, default 10000."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&VerifyMaterialBillboard));
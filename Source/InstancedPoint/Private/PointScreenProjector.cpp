@@ -0,0 +1,355 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointScreenProjector.h"
+#include "Engine/LocalPlayer.h"
+#include "Engine/GameViewportClient.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "PointViewState.h"
+#include "SceneView.h"
+#include "ConvexVolume.h"
+#include "Camera/CameraTypes.h"
+#include "Kismet/GameplayStatics.h"
+
+namespace PointScreenProjector
+{
+	struct FProjectionConstants
+	{
+		VectorRegister M00, M10, M20, M30;
+		VectorRegister M01, M11, M21, M31;
+		VectorRegister M03, M13, M23, M33;
+
+		//Clip space offset of UpOffset, the raised point is the base point plus this
+		VectorRegister UpClipX, UpClipY, UpClipW;
+
+		VectorRegister RectW, RectH;
+		VectorRegister ViewW, ViewH;
+		VectorRegister ScreenSize;
+	};
+
+	static const VectorRegister Half = MakeVectorRegister(0.5f, 0.5f, 0.5f, 0.5f);
+	static const VectorRegister MinW = MakeVectorRegister(KINDA_SMALL_NUMBER, KINDA_SMALL_NUMBER, KINDA_SMALL_NUMBER, KINDA_SMALL_NUMBER);
+	//Screen length is clamped to 0.01 pixel
+	static const VectorRegister MinLenSquared = MakeVectorRegister(0.0001f, 0.0001f, 0.0001f, 0.0001f);
+
+	static FORCEINLINE void ProjectBlock(const FProjectionConstants& C, const VectorRegister& X, const VectorRegister& Y, const VectorRegister& Z, VectorRegister& OutScale, int32& OutMask)
+	{
+		const VectorRegister ClipXA = VectorMultiplyAdd(X, C.M00, VectorMultiplyAdd(Y, C.M10, VectorMultiplyAdd(Z, C.M20, C.M30)));
+		const VectorRegister ClipYA = VectorMultiplyAdd(X, C.M01, VectorMultiplyAdd(Y, C.M11, VectorMultiplyAdd(Z, C.M21, C.M31)));
+		const VectorRegister ClipWA = VectorMultiplyAdd(X, C.M03, VectorMultiplyAdd(Y, C.M13, VectorMultiplyAdd(Z, C.M23, C.M33)));
+		const VectorRegister ClipXB = VectorAdd(ClipXA, C.UpClipX);
+		const VectorRegister ClipYB = VectorAdd(ClipYA, C.UpClipY);
+		const VectorRegister ClipWB = VectorAdd(ClipWA, C.UpClipW);
+
+		const VectorRegister RcpWA = VectorReciprocalAccurate(VectorMax(ClipWA, MinW));
+		const VectorRegister RcpWB = VectorReciprocalAccurate(VectorMax(ClipWB, MinW));
+
+		//Same mapping as FSceneView::ProjectWorldToScreen, relative to the view rect
+		const VectorRegister ScreenXA = VectorMultiply(VectorMultiplyAdd(VectorMultiply(ClipXA, RcpWA), Half, Half), C.RectW);
+		const VectorRegister ScreenYA = VectorMultiply(VectorSubtract(Half, VectorMultiply(VectorMultiply(ClipYA, RcpWA), Half)), C.RectH);
+		const VectorRegister ScreenXB = VectorMultiply(VectorMultiplyAdd(VectorMultiply(ClipXB, RcpWB), Half, Half), C.RectW);
+		const VectorRegister ScreenYB = VectorMultiply(VectorSubtract(Half, VectorMultiply(VectorMultiply(ClipYB, RcpWB), Half)), C.RectH);
+
+		const VectorRegister Zero = VectorZero();
+		VectorRegister Mask = VectorBitwiseAnd(VectorCompareGT(ClipWA, Zero), VectorCompareGT(ClipWB, Zero));
+		Mask = VectorBitwiseAnd(Mask, VectorBitwiseAnd(VectorCompareGT(ScreenXA, Zero), VectorCompareLT(ScreenXA, C.ViewW)));
+		Mask = VectorBitwiseAnd(Mask, VectorBitwiseAnd(VectorCompareGT(ScreenYA, Zero), VectorCompareLT(ScreenYA, C.ViewH)));
+		Mask = VectorBitwiseAnd(Mask, VectorBitwiseAnd(VectorCompareGT(ScreenXB, Zero), VectorCompareLT(ScreenXB, C.ViewW)));
+		Mask = VectorBitwiseAnd(Mask, VectorBitwiseAnd(VectorCompareGT(ScreenYB, Zero), VectorCompareLT(ScreenYB, C.ViewH)));
+
+		const VectorRegister DeltaX = VectorSubtract(ScreenXA, ScreenXB);
+		const VectorRegister DeltaY = VectorSubtract(ScreenYA, ScreenYB);
+		const VectorRegister LenSquared = VectorMax(VectorMultiplyAdd(DeltaX, DeltaX, VectorMultiply(DeltaY, DeltaY)), MinLenSquared);
+
+		OutScale = VectorMultiply(C.ScreenSize, VectorReciprocalSqrtAccurate(LenSquared));
+		OutMask = VectorMaskBits(Mask);
+	}
+}
+
+bool FPointScreenProjector::Init(APlayerController* PlayerController, const FVector2D& InViewportSize)
+{
+	bValid = false;
+
+	ULocalPlayer* const LocalPlayer = PlayerController ? PlayerController->GetLocalPlayer() : nullptr;
+	if (LocalPlayer && LocalPlayer->ViewportClient)
+	{
+		FSceneViewProjectionData ProjectionData;
+		if (LocalPlayer->GetProjectionData(LocalPlayer->ViewportClient->Viewport, eSSP_FULL, ProjectionData))
+		{
+			const FIntRect ViewRect = ProjectionData.GetConstrainedViewRect();
+
+			ViewOrigin = ProjectionData.ViewOrigin;
+			TranslatedViewProjectionMatrix = ProjectionData.ViewRotationMatrix * ProjectionData.ProjectionMatrix;
+			ViewRectSize = FVector2D(ViewRect.Width(), ViewRect.Height());
+			ViewportSize = InViewportSize;
+			bValid = true;
+		}
+	}
+
+	return bValid;
+}
+
+void FPointScreenProjector::Init(const FVector& InViewOrigin, const FMatrix& ViewRotationMatrix, const FMatrix& ProjectionMatrix, const FVector2D& InViewRectSize, const FVector2D& InViewportSize)
+{
+	ViewOrigin = InViewOrigin;
+	TranslatedViewProjectionMatrix = ViewRotationMatrix * ProjectionMatrix;
+	ViewRectSize = InViewRectSize;
+	ViewportSize = InViewportSize;
+	bValid = true;
+}
+
+void FPointScreenProjector::GetTranslatedViewFrustum(FConvexVolume& OutFrustum) const
+{
+	GetViewFrustumBounds(OutFrustum, TranslatedViewProjectionMatrix, true);
+}
+
+bool FPointScreenProjector::ProjectWorldToScreen(const FVector& WorldLocation, FVector2D& OutScreenLocation) const
+{
+	const FPlane Result = TranslatedViewProjectionMatrix.TransformFVector4(FVector4(WorldLocation - ViewOrigin, 1.f));
+	if (Result.W > 0.0f)
+	{
+		const float RHW = 1.0f / Result.W;
+		const float NormalizedX = (Result.X * RHW / 2.f) + 0.5f;
+		const float NormalizedY = 1.f - (Result.Y * RHW / 2.f) - 0.5f;
+		OutScreenLocation = FVector2D(NormalizedX * ViewRectSize.X, NormalizedY * ViewRectSize.Y);
+		return true;
+	}
+	return false;
+}
+
+template<typename FetchRelativeLocationType>
+void FPointScreenProjector::ProjectScalesImpl(int32 Num, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport, FetchRelativeLocationType&& FetchRelativeLocation) const
+{
+	using namespace PointScreenProjector;
+
+	OutScales.SetNumUninitialized(Num, false);
+	OutInViewport.SetNumUninitialized(Num, false);
+
+	if (Num == 0)
+	{
+		return;
+	}
+
+	const FMatrix& M = TranslatedViewProjectionMatrix;
+	const FPlane UpClip = M.TransformFVector4(FVector4(UpOffset, 0.f));
+
+	FProjectionConstants C;
+	C.M00 = VectorSetFloat1(M.M[0][0]); C.M10 = VectorSetFloat1(M.M[1][0]); C.M20 = VectorSetFloat1(M.M[2][0]); C.M30 = VectorSetFloat1(M.M[3][0]);
+	C.M01 = VectorSetFloat1(M.M[0][1]); C.M11 = VectorSetFloat1(M.M[1][1]); C.M21 = VectorSetFloat1(M.M[2][1]); C.M31 = VectorSetFloat1(M.M[3][1]);
+	C.M03 = VectorSetFloat1(M.M[0][3]); C.M13 = VectorSetFloat1(M.M[1][3]); C.M23 = VectorSetFloat1(M.M[2][3]); C.M33 = VectorSetFloat1(M.M[3][3]);
+	C.UpClipX = VectorSetFloat1(UpClip.X);
+	C.UpClipY = VectorSetFloat1(UpClip.Y);
+	C.UpClipW = VectorSetFloat1(UpClip.W);
+	C.RectW = VectorSetFloat1(ViewRectSize.X);
+	C.RectH = VectorSetFloat1(ViewRectSize.Y);
+	C.ViewW = VectorSetFloat1(ViewportSize.X);
+	C.ViewH = VectorSetFloat1(ViewportSize.Y);
+	C.ScreenSize = VectorSetFloat1(ScreenSize);
+
+	float* Scales = OutScales.GetData();
+	uint8* InViewport = OutInViewport.GetData();
+
+	for (int32 Base = 0; Base < Num; Base += 4)
+	{
+		//Pad the last block by repeating the last location
+		const FVector R0 = FetchRelativeLocation(Base);
+		const FVector R1 = FetchRelativeLocation(FMath::Min(Base + 1, Num - 1));
+		const FVector R2 = FetchRelativeLocation(FMath::Min(Base + 2, Num - 1));
+		const FVector R3 = FetchRelativeLocation(FMath::Min(Base + 3, Num - 1));
+
+		VectorRegister Scale;
+		int32 Mask;
+		ProjectBlock(C,
+			MakeVectorRegister(R0.X, R1.X, R2.X, R3.X),
+			MakeVectorRegister(R0.Y, R1.Y, R2.Y, R3.Y),
+			MakeVectorRegister(R0.Z, R1.Z, R2.Z, R3.Z),
+			Scale, Mask);
+
+		MS_ALIGN(16) float BlockScales[4] GCC_ALIGN(16);
+		VectorStoreAligned(Scale, BlockScales);
+
+		const int32 BlockNum = FMath::Min(4, Num - Base);
+		for (int32 Lane = 0; Lane < BlockNum; Lane++)
+		{
+			Scales[Base + Lane] = BlockScales[Lane];
+			InViewport[Base + Lane] = (Mask >> Lane) & 1;
+		}
+	}
+}
+
+void FPointScreenProjector::ProjectScales(TArrayView<const FVector> Locations, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const
+{
+	const FVector* Loc = Locations.GetData();
+	ProjectScalesImpl(Locations.Num(), UpOffset, ScreenSize, OutScales, OutInViewport,
+		[this, Loc](int32 i) { return Loc[i] - ViewOrigin; });
+}
+
+void FPointScreenProjector::ProjectScales(const FPointLocationCache& Locations, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const
+{
+	const double* X = Locations.X.GetData();
+	const double* Y = Locations.Y.GetData();
+	const double* Z = Locations.Z.GetData();
+	const double OriginX = ViewOrigin.X, OriginY = ViewOrigin.Y, OriginZ = ViewOrigin.Z;
+	ProjectScalesImpl(Locations.Num(), UpOffset, ScreenSize, OutScales, OutInViewport,
+		[=](int32 i) { return FVector(X[i] - OriginX, Y[i] - OriginY, Z[i] - OriginZ); });
+}
+
+void FPointScreenProjector::ProjectScales(const FPointLocationCache& Locations, TArrayView<const int32> Indices, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const
+{
+	const double* X = Locations.X.GetData();
+	const double* Y = Locations.Y.GetData();
+	const double* Z = Locations.Z.GetData();
+	const int32* Index = Indices.GetData();
+	const double OriginX = ViewOrigin.X, OriginY = ViewOrigin.Y, OriginZ = ViewOrigin.Z;
+	ProjectScalesImpl(Indices.Num(), UpOffset, ScreenSize, OutScales, OutInViewport,
+		[=](int32 i) { const int32 j = Index[i]; return FVector(X[j] - OriginX, Y[j] - OriginY, Z[j] - OriginZ); });
+}
+
+//ip.VerifyScreenProjector [NumViews]
+//Compares the SIMD ProjectScales overloads, with the projector built by FPointViewState::Init, against the engine's
+//per-instance projection: UGameplayStatics::GetViewProjectionMatrix for the same FMinimalViewInfo and
+//FSceneView::ProjectWorldToScreen, as APlayerController::ProjectWorldLocationToScreen does. Random views, with points
+//inside the view, near the frustum edges, around the camera plane and behind the camera
+static void VerifyScreenProjector(const TArray<FString>& Args)
+{
+	const int32 NumViews = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 100;
+	//Odd, the last SIMD block is padded
+	const int32 NumPoints = 1001;
+	const FVector2D ViewportSize(1920.0f, 1080.0f);
+	const FIntRect ViewRect(0, 0, 1920, 1080);
+	const float ScreenSize = 10.0f;
+	const float Tolerance = 1e-3f;
+	//The engine projects untranslated world positions in float, points this close to a viewport edge, in pixels,
+	//may land on either side
+	const float EdgeMargin = 0.05f;
+	//Kept near the origin so the engine's untranslated projection is itself precise enough to be the reference
+	const float MaxCameraDistance = 20000.0f;
+
+	FRandomStream Random(NumViews);
+	TArray<FVector> Locations;
+	FPointLocationCache Cache;
+	TArray<int32> Indices;
+	TArray<float> Scales[3];
+	TArray<uint8> InViewport[3];
+	float MaxScaleError = 0.0f;
+	int32 NumFlagErrors = 0;
+	int32 NumEdgeTolerated = 0;
+	int32 NumInViewport = 0;
+	int32 NumTested = 0;
+
+	for (int32 ViewIndex = 0; ViewIndex < NumViews; ViewIndex++)
+	{
+		const FVector CameraLocation = Random.GetUnitVector() * Random.FRandRange(0.0f, MaxCameraDistance);
+		const FRotator CameraRotation(Random.FRandRange(-89.0f, 89.0f), Random.FRandRange(-180.0f, 180.0f), 0.0f);
+		const float FOV = Random.FRandRange(30.0f, 110.0f);
+
+		FPointViewState View;
+		View.Init(CameraLocation, CameraRotation, FOV, ViewportSize);
+		const FPointScreenProjector& Projector = View.Projector;
+		const FVector UpOffset = View.ControllerUp * Random.FRandRange(10.0f, 500.0f);
+
+		FMinimalViewInfo ViewInfo;
+		ViewInfo.Location = CameraLocation;
+		ViewInfo.Rotation = CameraRotation;
+		ViewInfo.FOV = FOV;
+		ViewInfo.AspectRatio = ViewportSize.X / ViewportSize.Y;
+		ViewInfo.ProjectionMode = ECameraProjectionMode::Perspective;
+		FMatrix ViewMatrix;
+		FMatrix ProjectionMatrix;
+		FMatrix ViewProjectionMatrix;
+		UGameplayStatics::GetViewProjectionMatrix(ViewInfo, ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
+
+		const FRotationMatrix CameraAxes(CameraRotation);
+		const float TanHalfX = FMath::Tan(FMath::DegreesToRadians(FOV * 0.5f));
+		const float TanHalfY = TanHalfX * ViewportSize.Y / ViewportSize.X;
+
+		Locations.Reset();
+		for (int32 i = 0; i < NumPoints; i++)
+		{
+			float Depth = Random.FRandRange(100.0f, 200000.0f);
+			float U = Random.FRandRange(-0.9f, 0.9f);
+			float V = Random.FRandRange(-0.9f, 0.9f);
+			switch (i % 4)
+			{
+			case 1:
+				//On a frustum edge, a little inside or outside
+				(Random.FRand() < 0.5f ? U : V) = (Random.FRand() < 0.5f ? -1.0f : 1.0f) * Random.FRandRange(0.98f, 1.02f);
+				break;
+			case 2:
+				//Around the camera plane, W close to 0 or negative
+				Depth = Random.FRandRange(-50.0f, 50.0f);
+				break;
+			case 3:
+				//Behind the camera
+				Depth = -Random.FRandRange(100.0f, 200000.0f);
+				break;
+			}
+			Locations.Add(CameraLocation
+				+ CameraAxes.GetScaledAxis(EAxis::X) * Depth
+				+ CameraAxes.GetScaledAxis(EAxis::Y) * U * TanHalfX * FMath::Abs(Depth)
+				+ CameraAxes.GetScaledAxis(EAxis::Z) * V * TanHalfY * FMath::Abs(Depth));
+		}
+
+		Cache.X.SetNum(NumPoints);
+		Cache.Y.SetNum(NumPoints);
+		Cache.Z.SetNum(NumPoints);
+		Indices.SetNum(NumPoints);
+		for (int32 i = 0; i < NumPoints; i++)
+		{
+			Cache.X[i] = Locations[i].X;
+			Cache.Y[i] = Locations[i].Y;
+			Cache.Z[i] = Locations[i].Z;
+			Indices[i] = NumPoints - 1 - i;
+		}
+
+		Projector.ProjectScales(Locations, UpOffset, ScreenSize, Scales[0], InViewport[0]);
+		Projector.ProjectScales(Cache, UpOffset, ScreenSize, Scales[1], InViewport[1]);
+		Projector.ProjectScales(Cache, Indices, UpOffset, ScreenSize, Scales[2], InViewport[2]);
+
+		for (int32 i = 0; i < NumPoints; i++)
+		{
+			FVector2D ScreenA;
+			FVector2D ScreenB;
+			const bool bFrontA = FSceneView::ProjectWorldToScreen(Locations[i], ViewRect, ViewProjectionMatrix, ScreenA);
+			const bool bFrontB = FSceneView::ProjectWorldToScreen(Locations[i] + UpOffset, ViewRect, ViewProjectionMatrix, ScreenB);
+
+			auto IsInside = [&](const FVector2D& Screen) { return Screen.X > 0.0f && Screen.X < ViewportSize.X && Screen.Y > 0.0f && Screen.Y < ViewportSize.Y; };
+			auto IsNearEdge = [&](const FVector2D& Screen) { return FMath::Abs(Screen.X) < EdgeMargin || FMath::Abs(Screen.X - ViewportSize.X) < EdgeMargin || FMath::Abs(Screen.Y) < EdgeMargin || FMath::Abs(Screen.Y - ViewportSize.Y) < EdgeMargin; };
+			const bool bReferenceIn = bFrontA && bFrontB && IsInside(ScreenA) && IsInside(ScreenB);
+			const bool bNearEdge = bFrontA && bFrontB && (IsNearEdge(ScreenA) || IsNearEdge(ScreenB));
+			const float ReferenceScale = ScreenSize / FMath::Max(FVector2D::Distance(ScreenA, ScreenB), 0.01f);
+
+			for (int32 Path = 0; Path < 3; Path++)
+			{
+				const int32 Slot = Path == 2 ? NumPoints - 1 - i : i;
+				if ((InViewport[Path][Slot] != 0) != bReferenceIn)
+				{
+					NumEdgeTolerated += bNearEdge ? 1 : 0;
+					NumFlagErrors += bNearEdge ? 0 : 1;
+					continue;
+				}
+				if (bReferenceIn)
+				{
+					MaxScaleError = FMath::Max(MaxScaleError, FMath::Abs(Scales[Path][Slot] - ReferenceScale) / ReferenceScale);
+				}
+			}
+			NumInViewport += bReferenceIn ? 1 : 0;
+			NumTested++;
+		}
+	}
+
+	if (NumFlagErrors == 0 && MaxScaleError < Tolerance)
+	{
+		UE_LOG(LogTemp, Display, TEXT("VerifyScreenProjector passed: %d points, %d in viewport, max scale error %g, %d edge flags tolerated"), NumTested, NumInViewport, MaxScaleError, NumEdgeTolerated);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("VerifyScreenProjector failed: %d points, %d viewport flag mismatches, max scale error %g (tolerance %g)"), NumTested, NumFlagErrors, MaxScaleError, Tolerance);
+	}
+}
+
+static FAutoConsoleCommand VerifyScreenProjectorCommand(
+	TEXT("ip.VerifyScreenProjector"),
+	TEXT("Check the SIMD ProjectScales against the engine's FSceneView::ProjectWorldToScreen, including points behind the camera and on the frustum edges. Args: number of views, default 100."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&VerifyScreenProjector));
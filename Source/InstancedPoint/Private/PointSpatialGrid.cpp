@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointSpatialGrid.h"
+
+//Cells per axis are capped, very small cell sizes on large datasets grow the cells instead
+static const int32 MaxCellsPerAxis = 2048;
+
+void FPointSpatialGrid::Build(const FPointLocationCache& Locations, double InCellSize)
+{
+	Reset();
+
+	const int32 InstanceCount = Locations.Num();
+	if (InstanceCount == 0)
+	{
+		return;
+	}
+
+	double MinX = Locations.X[0], MaxX = Locations.X[0];
+	double MinY = Locations.Y[0], MaxY = Locations.Y[0];
+	for (int32 i = 1; i < InstanceCount; i++)
+	{
+		MinX = FMath::Min(MinX, Locations.X[i]);
+		MaxX = FMath::Max(MaxX, Locations.X[i]);
+		MinY = FMath::Min(MinY, Locations.Y[i]);
+		MaxY = FMath::Max(MaxY, Locations.Y[i]);
+	}
+
+	const double MaxExtent = FMath::Max(MaxX - MinX, MaxY - MinY);
+	CellSize = FMath::Max3(InCellSize, MaxExtent / MaxCellsPerAxis, 1.0);
+	OriginX = MinX;
+	OriginY = MinY;
+	NumCellsX = FMath::Min((int32)((MaxX - MinX) / CellSize) + 1, MaxCellsPerAxis);
+	NumCellsY = FMath::Min((int32)((MaxY - MinY) / CellSize) + 1, MaxCellsPerAxis);
+
+	const int32 NumCells = NumCellsX * NumCellsY;
+	TArray<int32> InstanceCells;
+	InstanceCells.SetNumUninitialized(InstanceCount);
+	CellStart.SetNumZeroed(NumCells + 1);
+
+	for (int32 i = 0; i < InstanceCount; i++)
+	{
+		const int32 CellX = FMath::Min((int32)((Locations.X[i] - OriginX) / CellSize), NumCellsX - 1);
+		const int32 CellY = FMath::Min((int32)((Locations.Y[i] - OriginY) / CellSize), NumCellsY - 1);
+		InstanceCells[i] = CellY * NumCellsX + CellX;
+		CellStart[InstanceCells[i] + 1]++;
+	}
+
+	for (int32 Cell = 0; Cell < NumCells; Cell++)
+	{
+		CellStart[Cell + 1] += CellStart[Cell];
+	}
+
+	//Counting sort, instances stay ascending inside each cell
+	TArray<int32> CellFill(CellStart.GetData(), NumCells);
+	CellInstances.SetNumUninitialized(InstanceCount);
+	for (int32 i = 0; i < InstanceCount; i++)
+	{
+		CellInstances[CellFill[InstanceCells[i]]++] = i;
+	}
+}
+
+void FPointSpatialGrid::Reset()
+{
+	NumCellsX = 0;
+	NumCellsY = 0;
+	CellStart.Reset();
+	CellInstances.Reset();
+}
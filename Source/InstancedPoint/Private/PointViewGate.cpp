@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointViewGate.h"
+#include "InstancedPoint.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/World.h"
+#include "Camera/PlayerCameraManager.h"
+#include "GameFramework/PlayerController.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Updates Skipped"), STAT_PointUpdatesSkipped, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Updates Run"), STAT_PointUpdatesRun, STATGROUP_InstancedPoint);
+
+bool FPointCameraState::Capture(UWorld* World)
+{
+	APlayerController* PlayerController = World ? World->GetFirstPlayerController() : nullptr;
+	if (!PlayerController || !PlayerController->PlayerCameraManager || !World->GetGameViewport())
+	{
+		return false;
+	}
+
+	Location = PlayerController->PlayerCameraManager->GetCameraLocation();
+	Rotation = PlayerController->PlayerCameraManager->GetCameraRotation();
+	ControllerRotation = PlayerController->GetActorRotation();
+	FOV = PlayerController->PlayerCameraManager->GetFOVAngle();
+	World->GetGameViewport()->GetViewportSize(ViewportSize);
+	return true;
+}
+
+bool FPointCameraState::Equals(const FPointCameraState& Other, float Tolerance) const
+{
+	return Location.Equals(Other.Location, Tolerance)
+		&& Rotation.Equals(Other.Rotation, Tolerance)
+		&& ControllerRotation.Equals(Other.ControllerRotation, Tolerance)
+		&& FMath::IsNearlyEqual(FOV, Other.FOV, Tolerance)
+		&& ViewportSize == Other.ViewportSize;
+}
+
+bool FPointViewGate::ShouldUpdate(const FPointCameraState& State, float Tolerance)
+{
+	if (!bForceUpdate && State.Equals(LastState, Tolerance))
+	{
+		INC_DWORD_STAT(STAT_PointUpdatesSkipped);
+		NumSkipped++;
+		return false;
+	}
+
+	INC_DWORD_STAT(STAT_PointUpdatesRun);
+	NumUpdated++;
+	LastState = State;
+	bForceUpdate = false;
+	return true;
+}
@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointViewState.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Math/InverseRotationMatrix.h"
+#include "Math/PerspectiveMatrix.h"
+
+bool FPointViewState::Capture(UWorld* World)
+{
+	bValid = false;
+	FrameNumber = GFrameCounter;
+
+	APlayerController* PlayerController = World ? World->GetFirstPlayerController() : nullptr;
+	if (!PlayerController || !Camera.Capture(World))
+	{
+		return false;
+	}
+
+	ViewportSize = Camera.ViewportSize;
+	if (!Projector.Init(PlayerController, ViewportSize))
+	{
+		return false;
+	}
+
+	CameraLocation = Camera.Location;
+	CameraForward = Camera.Rotation.Vector();
+	ControllerUp = PlayerController->GetActorUpVector();
+	ControllerForward = PlayerController->GetActorForwardVector();
+	bValid = true;
+	return true;
+}
+
+void FPointViewState::Init(const FVector& Location, const FRotator& Rotation, float FOV, const FVector2D& InViewportSize)
+{
+	FrameNumber = GFrameCounter;
+
+	Camera.Location = Location;
+	Camera.Rotation = Rotation;
+	Camera.ControllerRotation = Rotation;
+	Camera.FOV = FOV;
+	Camera.ViewportSize = InViewportSize;
+
+	CameraLocation = Location;
+	CameraForward = Rotation.Vector();
+	ControllerUp = FRotationMatrix(Rotation).GetScaledAxis(EAxis::Z);
+	ControllerForward = CameraForward;
+	ViewportSize = InViewportSize;
+
+	//Same conventions as the local player view: X forward, Z up, reversed Z projection
+	const FMatrix ViewRotationMatrix = FInverseRotationMatrix(Rotation) * FMatrix(
+		FPlane(0, 0, 1, 0),
+		FPlane(1, 0, 0, 0),
+		FPlane(0, 1, 0, 0),
+		FPlane(0, 0, 0, 1));
+	const FMatrix ProjectionMatrix = FReversedZPerspectiveMatrix(FMath::DegreesToRadians(FOV * 0.5f), FMath::Max(InViewportSize.X, 1.0f), FMath::Max(InViewportSize.Y, 1.0f), GNearClippingPlane);
+	Projector.Init(Location, ViewRotationMatrix, ProjectionMatrix, InViewportSize, InViewportSize);
+
+	bValid = true;
+}
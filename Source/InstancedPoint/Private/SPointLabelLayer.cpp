@@ -0,0 +1,267 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SPointLabelLayer.h"
+#include "Fonts/FontCache.h"
+#include "Framework/Application/SlateApplication.h"
+#include "Rendering/DrawElements.h"
+#include "Rendering/SlateRenderer.h"
+#include "HInstancedPointComponent.h"
+#include "InstancedPoint.h"
+#include "InstancedPointSubsystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Point Label Layer Paint"), STAT_PointLabelLayerPaint, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Labels Drawn"), STAT_PointLabelsDrawn, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Labels Shaped"), STAT_PointLabelsShaped, STATGROUP_InstancedPoint);
+DECLARE_CYCLE_STAT(TEXT("Point Label Placement"), STAT_PointLabelPlacement, STATGROUP_InstancedPoint);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Point Label Candidates"), STAT_PointLabelCandidates, STATGROUP_InstancedPoint);
+
+//Shaped strings kept before the cache is flushed
+static const int32 MaxShapedTextCacheSize = 32768;
+
+//Camera movement (cm, degrees) that places the labels again
+static const float LabelCameraTolerance = 0.01f;
+
+void SPointLabelLayer::Construct(const FArguments& InArgs)
+{
+	Font = InArgs._Font;
+	ColorAndOpacity = InArgs._ColorAndOpacity;
+	ShadowColorAndOpacity = InArgs._ShadowColorAndOpacity;
+	ShadowOffset = InArgs._ShadowOffset;
+	Pivot = InArgs._Pivot;
+	ScreenOffset = InArgs._ScreenOffset;
+	MaxLabels = InArgs._MaxLabels;
+	bDeclutter = InArgs._bDeclutter;
+	DeclutterCellSize = InArgs._DeclutterCellSize;
+}
+
+void SPointLabelLayer::AddPointComponent(UHInstancedPointComponent* Component)
+{
+	if (Component)
+	{
+		Components.AddUnique(Component);
+		LabelGate.ForceUpdate();
+	}
+}
+
+void SPointLabelLayer::RemovePointComponent(UHInstancedPointComponent* Component)
+{
+	Components.Remove(Component);
+	LabelGate.ForceUpdate();
+}
+
+void SPointLabelLayer::SetFont(const FSlateFontInfo& InFont)
+{
+	if (!Font.IsIdenticalTo(InFont))
+	{
+		Font = InFont;
+		ShapedTextCache.Reset();
+		LabelGate.ForceUpdate();
+	}
+}
+
+void SPointLabelLayer::SetColorAndOpacity(const FLinearColor& InColor, const FLinearColor& InShadowColor, const FVector2D& InShadowOffset)
+{
+	ColorAndOpacity = InColor;
+	ShadowColorAndOpacity = InShadowColor;
+	ShadowOffset = InShadowOffset;
+}
+
+void SPointLabelLayer::SetPlacement(const FVector2D& InPivot, const FVector2D& InScreenOffset)
+{
+	Pivot = InPivot;
+	ScreenOffset = InScreenOffset;
+	LabelGate.ForceUpdate();
+}
+
+void SPointLabelLayer::SetMaxLabels(int32 InMaxLabels)
+{
+	MaxLabels = InMaxLabels;
+	LabelGate.ForceUpdate();
+}
+
+void SPointLabelLayer::SetDeclutter(bool bInDeclutter, float InCellSize)
+{
+	bDeclutter = bInDeclutter;
+	DeclutterCellSize = InCellSize;
+	LabelGate.ForceUpdate();
+}
+
+FVector2D SPointLabelLayer::ComputeDesiredSize(float LayoutScaleMultiplier) const
+{
+	return FVector2D::ZeroVector;
+}
+
+FShapedGlyphSequenceRef SPointLabelLayer::GetShapedText(const FString& Text, float FontScale) const
+{
+	if (CachedFontScale != FontScale || ShapedTextCache.Num() >= MaxShapedTextCacheSize)
+	{
+		ShapedTextCache.Reset();
+		CachedFontScale = FontScale;
+	}
+
+	if (const FShapedGlyphSequenceRef* Shaped = ShapedTextCache.Find(Text))
+	{
+		return *Shaped;
+	}
+
+	INC_DWORD_STAT(STAT_PointLabelsShaped);
+	const TSharedRef<FSlateFontCache> FontCache = FSlateApplication::Get().GetRenderer()->GetFontCache();
+	FShapedGlyphSequenceRef Shaped = FontCache->ShapeBidirectionalText(Text, Font, FontScale, TextBiDi::ETextDirection::LeftToRight, GetDefaultTextShapingMethod());
+	ShapedTextCache.Add(Text, Shaped);
+	return Shaped;
+}
+
+uint32 SPointLabelLayer::GetLabelContentHash(const FGeometry& AllottedGeometry) const
+{
+	uint32 Hash = GetTypeHash(AllottedGeometry.GetLocalSize());
+	Hash = HashCombine(Hash, GetTypeHash(AllottedGeometry.Scale));
+	for (const TWeakObjectPtr<UHInstancedPointComponent>& WeakComponent : Components)
+	{
+		const UHInstancedPointComponent* Component = WeakComponent.Get();
+		Hash = HashCombine(Hash, GetTypeHash(Component));
+		if (Component)
+		{
+			Hash = HashCombine(Hash, Component->NameSetVersion);
+			Hash = HashCombine(Hash, Component->NameContentVersion);
+			Hash = HashCombine(Hash, GetTypeHash(Component->SelectedInstanceIndex));
+			Hash = HashCombine(Hash, Component->IsVisible() ? 1u : 0u);
+		}
+	}
+	return Hash;
+}
+
+void SPointLabelLayer::PlaceLabels(const FGeometry& AllottedGeometry) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_PointLabelPlacement);
+
+	const float FontScale = AllottedGeometry.Scale;
+	const float InverseScale = 1.0f / FMath::Max(FontScale, KINDA_SMALL_NUMBER);
+	const FVector2D LocalSize = AllottedGeometry.GetLocalSize();
+
+	Declutter.Reset();
+	CandidateLabels.Reset();
+
+	for (const TWeakObjectPtr<UHInstancedPointComponent>& WeakComponent : Components)
+	{
+		const UHInstancedPointComponent* Component = WeakComponent.Get();
+		if (!Component || !Component->IsVisible() || Component->NameMap.Num() == 0)
+		{
+			continue;
+		}
+
+		const FPointViewState* View = UInstancedPointSubsystem::FindViewState(Component);
+		if (!View || View->ViewportSize.X <= 0.0f || View->ViewportSize.Y <= 0.0f)
+		{
+			continue;
+		}
+
+		//Projected points are in viewport pixels, the layer covers the viewport
+		const FVector2D ViewportToLocal = LocalSize / View->ViewportSize;
+		const float InvNameDistance = 1.0f / FMath::Max(Component->NameCullingDistance, 1.0f);
+
+		for (TConstSetBitIterator<> It(Component->NameShownBits); It; ++It)
+		{
+			const int32 InstIndex = It.GetIndex();
+			const FString* Name = Component->NameMap.Find(InstIndex);
+			if (!Name || Name->IsEmpty())
+			{
+				continue;
+			}
+
+			const FVector Location = Component->GetPointLocation(InstIndex);
+			FVector2D ScreenLocation;
+			if (!View->Projector.ProjectWorldToScreen(Location, ScreenLocation))
+			{
+				continue;
+			}
+
+			FShapedGlyphSequenceRef Shaped = GetShapedText(*Name, FontScale);
+			const FVector2D LabelSize = FVector2D(Shaped->GetMeasuredWidth(), Shaped->GetMaxTextHeight()) * InverseScale;
+			const FVector2D LabelOffset = ScreenLocation * ViewportToLocal + ScreenOffset - Pivot * LabelSize;
+			if (LabelOffset.X > LocalSize.X || LabelOffset.Y > LocalSize.Y || LabelOffset.X + LabelSize.X < 0.0f || LabelOffset.Y + LabelSize.Y < 0.0f)
+			{
+				continue;
+			}
+
+			//The selected point alone in the top bucket, then half nearness and half attribute priority
+			float Priority = 1.0f;
+			if (InstIndex != Component->SelectedInstanceIndex)
+			{
+				const float Nearness = 1.0f - FMath::Clamp((Location - View->CameraLocation).Size() * InvNameDistance, 0.0f, 1.0f);
+				const float* Attribute = Component->NamePriorityMap.Find(InstIndex);
+				const float UnselectedScale = (float)(FPointLabelDeclutter::NumPriorityBuckets - 1) / FPointLabelDeclutter::NumPriorityBuckets;
+				Priority = UnselectedScale * (0.5f * Nearness + 0.5f * FMath::Clamp(Attribute ? *Attribute : 0.0f, 0.0f, 1.0f));
+			}
+
+			Declutter.AddCandidate(LabelOffset, LabelSize, Priority);
+			CandidateLabels.Add({ MoveTemp(Shaped), LabelOffset, LabelSize });
+		}
+	}
+	INC_DWORD_STAT_BY(STAT_PointLabelCandidates, CandidateLabels.Num());
+
+	PlacedLabels.Reset();
+	if (bDeclutter)
+	{
+		Declutter.Place(LocalSize, DeclutterCellSize, MaxLabels, PlacedSlots);
+		for (int32 Slot : PlacedSlots)
+		{
+			PlacedLabels.Add(CandidateLabels[Slot]);
+		}
+	}
+	else
+	{
+		const int32 NumPlaced = MaxLabels > 0 ? FMath::Min(MaxLabels, CandidateLabels.Num()) : CandidateLabels.Num();
+		PlacedLabels.Append(CandidateLabels.GetData(), NumPlaced);
+	}
+	CandidateLabels.Reset();
+}
+
+int32 SPointLabelLayer::OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_PointLabelLayerPaint);
+
+	//Labels are placed again only when the camera, the shown names or the layer changed
+	const uint32 ContentHash = GetLabelContentHash(AllottedGeometry);
+	if (ContentHash != LabelContentHash || AllottedGeometry.Scale != CachedFontScale)
+	{
+		LabelContentHash = ContentHash;
+		LabelGate.ForceUpdate();
+	}
+
+	const FPointViewState* View = nullptr;
+	for (const TWeakObjectPtr<UHInstancedPointComponent>& WeakComponent : Components)
+	{
+		if (WeakComponent.IsValid())
+		{
+			View = UInstancedPointSubsystem::FindViewState(WeakComponent.Get());
+			break;
+		}
+	}
+	if (!View)
+	{
+		PlacedLabels.Reset();
+	}
+	else if (LabelGate.ShouldUpdate(View->Camera, LabelCameraTolerance))
+	{
+		PlaceLabels(AllottedGeometry);
+	}
+
+	const ESlateDrawEffect DrawEffects = ShouldBeEnabled(bParentEnabled) ? ESlateDrawEffect::None : ESlateDrawEffect::DisabledEffect;
+	const FLinearColor TextColor = ColorAndOpacity * InWidgetStyle.GetColorAndOpacityTint();
+	const FLinearColor ShadowColor = ShadowColorAndOpacity * InWidgetStyle.GetColorAndOpacityTint();
+	const bool bShadow = ShadowColor.A > 0.0f && !ShadowOffset.IsZero();
+
+	for (const FPlacedLabel& Label : PlacedLabels)
+	{
+		if (bShadow)
+		{
+			FSlateDrawElement::MakeShapedText(OutDrawElements, LayerId, AllottedGeometry.ToPaintGeometry(Label.Size, FSlateLayoutTransform(Label.Offset + ShadowOffset)), Label.Shaped, DrawEffects, ShadowColor, ShadowColor);
+		}
+		FSlateDrawElement::MakeShapedText(OutDrawElements, LayerId + 1, AllottedGeometry.ToPaintGeometry(Label.Size, FSlateLayoutTransform(Label.Offset)), Label.Shaped, DrawEffects, TextColor, TextColor);
+	}
+
+	NumLabelsDrawn = PlacedLabels.Num();
+	INC_DWORD_STAT_BY(STAT_PointLabelsDrawn, NumLabelsDrawn);
+	return LayerId + 1;
+}
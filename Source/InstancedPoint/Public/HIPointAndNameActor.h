@@ -6,6 +6,9 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "PointScreenProjector.h"
+#include "PointLocationCache.h"
+#include "PointBillboardUpdate.h"
 #include "HIPointAndNameActor.generated.h"
 
 class UHierarchicalInstancedStaticMeshComponent;
@@ -21,9 +24,14 @@ public:
 	AHIPointAndNameActor();
 
 protected:
+	virtual void PostInitializeComponents() override;
+
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	//Destroyed or streamed out, its name widgets no longer count as live
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
@@ -41,6 +49,10 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void UpdateTransform();
 
+	//Read the instance locations again on the next update. Done by itself when instances of HIPoint are added, removed or moved
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void InvalidateLocationCache();
+
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void SetLockZ(bool Lock);
 
@@ -68,6 +80,15 @@ public:
 	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
 		bool bCulling = true;
 
+	//Hide out of range instances by clearing HIPoint's PerInstanceCustomData[VisibilityCustomDataIndex],
+	//the material collapses the vertices when it is 0 through InstancedPointVisibility.ush. Hidden instances
+	//are not written again. Without an IP_CustomDataVisibility material parameter instances are hidden by scale.
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bHideWithCustomData = false;
+
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 VisibilityCustomDataIndex = 0;
+
 	//UPROPERTY(EditAnywhere, Category = "InstancedPoint")
 		TMap<int32, UWidgetComponent*> ShowNameMap;
 
@@ -82,4 +103,54 @@ public:
 
 	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
 		FVector2D NamePivot = FVector2D(0.5, 2.5);
+
+	//Name widgets created in BeginPlay, before any point gets in NameCullingDistance
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 NameWidgetPoolWarmSize = 16;
+
+	//Most name widgets alive at once, shown or pooled. Points past it show no name. 0 for no limit
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 NameWidgetPoolMaxSize = 256;
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetNameWidgetCount() const { return NumNameWidgets; }
+
+protected:
+	//Take a hidden widget from the pool, or create one under NameWidgetPoolMaxSize
+	UWidgetComponent* AcquireNameWidget();
+
+	UWidgetComponent* CreateNameWidget();
+
+	//Hide the widget and keep it for the next point
+	void ReleaseNameWidget(UWidgetComponent* Widget);
+
+	void ShowName(int32 InstIndex, const FVector& InstanceLocation);
+
+	void HideName(int32 InstIndex);
+
+	void HideAllNames();
+
+	template<bool bVisibilityCustomData>
+	friend struct THIPointNameApplySink;
+
+	//Hidden widgets ready to be bound to a point
+	UPROPERTY(Transient)
+		TArray<UWidgetComponent*> FreeNameWidgets;
+
+	int32 NumNameWidgets = 0;
+
+	FPointScreenProjector ScreenProjector;
+
+	FPointLocationCache LocationCache;
+
+	//bHideWithCustomData the location cache was built with
+	bool bHidingWithCustomData = false;
+	bool bWarnedMissingVisibility = false;
+
+	//Every instance, in index order
+	TArray<int32> BillboardCandidates;
+
+	TArray<FPointBillboardChunkScratch> BillboardScratch;
+
+	FPointBillboardOutput BillboardOutput;
 };
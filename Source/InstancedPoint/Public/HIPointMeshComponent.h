@@ -0,0 +1,30 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "PointInstanceChangeTracking.h"
+#include "HIPointMeshComponent.generated.h"
+
+/**
+ * The instances of AHIPointAndNameActor. Reports instances added, removed or moved by anyone
+ * but the owner's own billboard commit, so the owner knows its location cache is stale.
+ */
+UCLASS(ClassGroup = Rendering, meta = (BlueprintSpawnableComponent))
+class INSTANCEDPOINT_API UHIPointMeshComponent : public UHierarchicalInstancedStaticMeshComponent
+{
+	GENERATED_BODY()
+
+	POINT_INSTANCE_CHANGE_OVERRIDES();
+
+public:
+	//Instance locations changed, or the component moved
+	FSimpleMulticastDelegate OnInstancesChanged;
+
+	//Set while the owner writes its billboard transforms, which keep the instance locations
+	bool bCommittingInstanceTransforms = false;
+
+private:
+	void NotifyInstancesChanged(bool bInstancesRemoved) { OnInstancesChanged.Broadcast(); }
+};
@@ -4,8 +4,28 @@
 
 #include "CoreMinimal.h"
 #include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "PointScreenProjector.h"
+#include "PointLocationCache.h"
+#include "PointBillboardUpdate.h"
+#include "PointViewGate.h"
+#include "PointSpatialGrid.h"
+#include "PointClusterCuller.h"
+#include "PointInstanceUploadBuffer.h"
+#include "PointInstanceChangeTracking.h"
 #include "HInstancedPointComponent.generated.h"
 
+class UHInstancedPointComponent;
+
+//Applies the results of an async billboard update in a later tick group
+struct FHInstancedPointCommitTickFunction : public FTickFunction
+{
+	UHInstancedPointComponent* Target = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+
+	virtual FString DiagnosticMessage() override;
+};
+
 /**
  * 
  */
@@ -17,6 +37,8 @@ class INSTANCEDPOINT_API UHInstancedPointComponent : public UHierarchicalInstanc
 public:
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FEOnCullingName, FString, InType, int32, Index, FVector, Location, bool, Culling);
 
+	DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FOnNamesCulled, FString, InType, const TArray<int32>&, Entered, const TArray<int32>&, Exited);
+
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnSelectPatternCulling);
 
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnFilterOffName, FString, InType);
@@ -36,28 +58,299 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void UpdateTransform();
 
+	//Selection and view gate, true when this frame needs an update
+	bool ShouldUpdateThisFrame();
+
+	//Like UpdateTransform, but when it returns true the billboard compute pass is left to the caller:
+	//ComputeDeferredRange over 0..GetNumDeferredCandidates() (any thread), then FinishDeferredUpdate.
+	bool UpdateTransformDeferred();
+
+	int32 GetNumDeferredCandidates() const { return BillboardCandidates.Num(); }
+
+	void ComputeDeferredRange(int32 Start, int32 End, FPointBillboardChunkScratch& Scratch);
+
+	void FinishDeferredUpdate();
+
+	//Updated by UInstancedPointSubsystem instead of its own tick
+	bool IsCentrallyUpdated() const { return bCentralUpdate; }
+
+	//Wait for the async update in flight, if any, and apply its results
+	void CommitAsyncBillboardUpdate();
+
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void SetLockZ(bool Lock);
 
 	void UpdateName(float ScrDis, int32 InstIndex, FVector InstanceLocation);
 
-	void UpdateType(int32 InstIndex, FVector InstanceLocation, AActor* iNFriController, FVector2D InViewSize, FTransform InInstanceTransform);
+	//Send the name changes collected since the last call as one OnNamesCulled
+	void BroadcastNameChanges();
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		bool IsNameShown(int32 Index) const;
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		TArray<int32> GetShownNames() const;
+
+	//World location of an instance, from the location cache when it is up to date
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		FVector GetPointLocation(int32 Index) const;
 
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void SetCulling(float PatternDis, float NameDis);
 
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
-		void SelectInstance(int32 Index) { SelectedInstanceIndex = Index; }
+		void SelectInstance(int32 Index) { SelectedInstanceIndex = Index; ViewGate.ForceUpdate(); }
+
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void UnselectInstance() { SelectedInstanceIndex = -1; ViewGate.ForceUpdate(); }
+
+	//NameMap and NamePriorityMap are only edited through these, label layers then place their labels again
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void SetPointName(int32 Index, const FString& Name);
+
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void RemovePointName(int32 Index);
+
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void SetNamePriority(int32 Index, float Priority);
 
+	//Update on the next tick even if the camera did not move
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
-		void UnselectInstance() { SelectedInstanceIndex = -1; }
+		void ForceTransformUpdate() { ViewGate.ForceUpdate(); }
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetSkippedUpdateCount() const { return ViewGate.GetNumSkipped(); }
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetRunUpdateCount() const { return ViewGate.GetNumUpdated(); }
+
+	//Instances currently shown, the ones not collapsed or hidden by the last update
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetShownInstanceCount() const { return NumShownInstances; }
+
+	//Cluster tree replacements over the last minute, by the engine or by bStableClusterTree
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetTreeRebuildsPerMinute() const { return TreeChangeTimes.Num(); }
 
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 		void FilterOffname();
 
+	//Switch bMaterialBillboard. The mesh material has to match, see bMaterialBillboard
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void SetMaterialBillboard(bool bEnable);
+
+	//Point index of the instances from FirstInstance on, as added by UPointLibrary::PopulatePointComponent
+	void SetInstancePointIndices(int32 FirstInstance, TArrayView<const int32> PointIndices);
+
+	//Dataset point index of an instance, -1 when it was not added from a dataset
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetPointIndex(int32 InstanceIndex) const;
+
+	//Instance showing a dataset point, -1 when there is none
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetInstanceIndex(int32 PointIndex) const;
+
+	//Stop billboard updates and cluster tree builds while instances are added over several frames
+	void BeginBulkLoad();
+
+	//Updates resume and the cluster tree is built once, asynchronously unless bStableClusterTree
+	void EndBulkLoad();
+
+	bool IsBulkLoading() const { return NumBulkLoads > 0; }
+
 	FTransform GetMinTransform(FVector Loc);
 
 	FVector GetMinScale3D();
+
+	//Instance adds, removes and moves invalidate the location cache
+	POINT_INSTANCE_CHANGE_OVERRIDES();
+
+	virtual void RegisterComponentTickFunctions(bool bRegister) override;
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	virtual void BeginDestroy() override;
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+protected:
+	//Removes also drop the point indices, they no longer line up
+	void NotifyInstancesChanged(bool bInstancesRemoved);
+
+	void InvalidateLocationCache();
+
+	bool RunUpdate(bool bDeferCompute);
+
+	bool CanUpdateTransform();
+
+	FPointViewGate ViewGate;
+
+	int32 GatedSelectedInstanceIndex = -1;
+
+	void QueueInstanceTransform(int32 InstIndex, const FTransform& NewTransform);
+
+	void QueueInstanceVisibility(int32 InstIndex, bool bVisible);
+
+	void SetAppliedScale(int32 InstIndex, float Scale);
+
+	//bHideWithCustomData, when the materials read the flag
+	bool CanHideWithCustomData();
+
+	void ReportShownInstances();
+
+	void FlushInstanceTransforms();
+
+	void RebuildSpatialIndex();
+
+	void GatherBillboardCandidates(const FPointBillboardParams& Params);
+
+	//Compute and queue the transforms of BillboardCandidates, adds the instances left shown to OutActiveInstances
+	void CommitBillboardCandidates(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances);
+
+	//Queue the transforms of BillboardOutput, computed for BillboardCandidates with Params
+	void ApplyBillboardOutput(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances);
+
+	template<bool bVisibilityCustomData>
+	void ApplyBillboardOutputKernel(const FPointBillboardParams& Params, TArray<int32>& OutActiveInstances);
+
+	template<bool bVisibilityCustomData>
+	friend struct THIPointApplySink;
+
+	bool ShouldUpdateAsync() const;
+
+	void LaunchAsyncBillboardUpdate(const FPointBillboardParams& Params);
+
+	void WaitForAsyncBillboardUpdate();
+
+	void UpdateTimeSliced(FPointBillboardParams& Params, const FVector& CameraForward);
+
+	void BeginTimeSlicedPass(const FPointBillboardParams& Params, const FVector& CameraForward);
+
+	void AbandonTimeSlicedPass();
+
+	void ResetTimeSlicedPass();
+
+	bool IsTimeSlicedPassRunning() const { return TimeSlicedCursor < TimeSlicedInstances.Num(); }
+
+	//Queued instance indices, ascending, and their new world transforms
+	TArray<int32> PendingIndices;
+	TArray<FTransform> PendingTransforms;
+	TArray<FTransform> PendingRunTransforms;
+
+	//Queued visibility flag writes, committed before the transforms
+	TArray<int32> PendingVisibilityIndices;
+	TArray<uint8> PendingVisibilityValues;
+
+	//bHideWithCustomData the location cache was built with
+	bool bHidingWithCustomData = false;
+	bool bWarnedMissingVisibility = false;
+
+	int32 NumShownInstances = 0;
+	int32 ReportedShownInstances = 0;
+
+	//Build and pad the cluster tree when bStableClusterTree needs it
+	void UpdateStableClusterTree();
+
+	//Time the cluster tree replacements for the rebuild rate stat
+	void TrackClusterTreeChanges();
+
+	bool bStableTreeApplied = false;
+
+	//Instances changed since the padded tree was built
+	bool bStableTreeDirty = true;
+
+	//Identity of the trees, only compared
+	const TArray<FClusterNode>* PaddedClusterTree = nullptr;
+	const TArray<FClusterNode>* LastClusterTree = nullptr;
+
+	TArray<double> TreeChangeTimes;
+	int32 ReportedTreeChanges = 0;
+
+	//ip.DirectInstanceUpdate is on and the render data can be updated in place
+	bool CanUploadInPlace() const;
+
+	//bDirectInstanceUpdate and CanUploadInPlace, and the cluster tree holds the new scales
+	bool ShouldUseDirectUpload() const;
+
+	//Write the instance data of bMaterialBillboard, once per change of the instances
+	void ApplyMaterialBillboard();
+
+	//Culling and facing settings as material parameters
+	void UpdateMaterialBillboardParameters();
+
+	bool bMaterialBillboardDirty = true;
+
+	int32 NumBulkLoads = 0;
+
+	//Instance index to point index. Cleared when instances are removed, their indices shift
+	TArray<int32> InstancePointIndices;
+
+	//Point index to instance index, only for the instances whose point index is not their own index
+	TMap<int32, int32> RemappedPointInstances;
+
+	void ResetInstancePointIndices();
+
+	FPointInstanceUploadBuffer InstanceUploadBuffer;
+
+	bool bQueueingInstanceTransforms = false;
+
+	//Set while our own billboard transforms are committed, these never move an instance
+	bool bCommittingInstanceTransforms = false;
+
+	FPointLocationCache LocationCache;
+
+	FPointSpatialGrid SpatialGrid;
+
+	float SpatialGridPatternDistance = 0.0f;
+
+	//Instances that are not collapsed after the last update, the only ones outside the pattern sphere that need a visit
+	TArray<int32> ActiveInstances;
+
+	//Instances visited by this update, ascending
+	TArray<int32> BillboardCandidates;
+
+	//One EPointFrustumResult per candidate, empty when the cluster tree is not used
+	TArray<uint8> CandidateFrustum;
+
+	TArray<uint32> CandidateStamps;
+	TArray<uint32> FrustumStamps;
+	uint32 CandidateStamp = 0;
+
+	FPointClusterCuller ClusterCuller;
+
+	//Candidates of the running time sliced pass in priority order, the ones before the cursor are done
+	TArray<int32> TimeSlicedInstances;
+	int32 TimeSlicedCursor = 0;
+
+	//Instances shown so far by the running pass, replaces ActiveInstances when it ends
+	TArray<int32> TimeSlicedActiveInstances;
+
+	//Measured microseconds per instance, sizes the next slice
+	double TimeSlicedCostPerInstance = 0.2;
+
+	FHInstancedPointCommitTickFunction CommitTickFunction;
+
+	FGraphEventRef AsyncBillboardTask;
+
+	//Params of the compute pass left to UInstancedPointSubsystem
+	FPointBillboardParams DeferredParams;
+
+	bool bDeferredComputePending = false;
+
+	bool bCentralUpdate = false;
+
+	//Snapshot the task computes with, its view and selection are the ones of the tick that launched it
+	FPointBillboardParams AsyncParams;
+
+	FPointScreenProjector ScreenProjector;
+
+	FRotator BillboardRotator;
+
+	TArray<FPointBillboardChunkScratch> BillboardScratch;
+
+	FPointBillboardOutput BillboardOutput;
+
 public:
 		FString Type;
 
@@ -83,15 +376,109 @@ public:
 	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
 		bool bCulling = true;
 
+	//One bit per instance, set while its name is in range
+	TBitArray<> NameShownBits;
+
+	//Name changes of the current update, sent by BroadcastNameChanges
+	TArray<int32> NamesEntered;
+	TArray<int32> NamesExited;
+
+	//Names drawn by UPointLabelLayer while the point is in NameCullingDistance
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		TMap<int32, FString> NameMap;
+
+	//Label priority in 0..1, overlapping labels of lower priority are dropped
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		TMap<int32, float> NamePriorityMap;
+
+	//Changes whenever NameShownBits or the point locations change, label layers place their labels again
+	uint32 NameSetVersion = 0;
+
+	//Changes whenever NameMap or NamePriorityMap is edited
+	uint32 NameContentVersion = 0;
+
+	//Also fire EOnCullingName once per name change, as before OnNamesCulled existed
 	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
-		TMap<int32, FVector> ShowNameMap;
+		bool bBroadcastPerInstanceNameEvents = false;
 
 	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
 		int32 SelectedInstanceIndex = -1;
 
+	//Run the per instance billboard work across the task graph, see ip.ParallelBillboardUpdate
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bParallelUpdate = true;
+
+	//Spread the update over several frames within the world budget, see ip.BillboardBudgetMicroseconds
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bTimeSlicedUpdate = false;
+
+	//Time sliced updates refresh every visible instance within this many frames, whatever the budget
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "1"))
+		int32 MaxRefreshFrames = 8;
+
+	//Hide instances by clearing a per instance custom data value instead of writing a tiny transform.
+	//Hidden instances keep their transform and are not written again. The mesh material must read
+	//PerInstanceCustomData[VisibilityCustomDataIndex] through InstancedPointVisibilityOffset
+	//(Shaders/Private/InstancedPointVisibility.ush) and have an IP_CustomDataVisibility scalar parameter,
+	//otherwise instances are hidden by scale. Every instance starts hidden when NumCustomDataFloats is
+	//raised to make room for it.
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bHideWithCustomData = false;
+
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 VisibilityCustomDataIndex = 0;
+
+	//Billboards never grow past this scale, 0 for no limit. Required by bStableClusterTree and bMaterialBillboard
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		float MaxBillboardScale = 0;
+
+	//Build the cluster tree once from the instance locations, with node bounds padded to any rotation
+	//at MaxBillboardScale. Billboard updates then go to the instances without rebuilding the tree.
+	//Adding, removing or moving instances builds it again, synchronously.
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bStableClusterTree = false;
+
+	//Send billboard transforms straight to the render instance buffer, only the instances whose
+	//rotation or scale changed, without a render state update. Needs bStableClusterTree, see ip.DirectInstanceUpdate.
+	//bHideWithCustomData flags are always sent this way when no transform needs the engine path
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bDirectInstanceUpdate = false;
+
+	//Leave facing and screen size to the mesh material, the component stops ticking. Instances get
+	//an identity rotation and scale 1, and their world location and BoundSize in PerInstanceCustomData
+	//[MaterialCustomDataIndex] to [MaterialCustomDataIndex + 3]. The material passes them with the
+	//IP_ScreenSize, IP_PatternCullingDistance, IP_MaxScale and IP_LockZ parameters to
+	//InstancedPointMaterialBillboard (/Plugin/InstancedPoint/Private/InstancedPointBillboard.ush)
+	//in World Position Offset. Names are not culled in this mode. Needs a positive MaxBillboardScale,
+	//the cluster bounds are padded to it; without one the component billboards on the CPU.
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bMaterialBillboard = false;
+
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 MaterialCustomDataIndex = 0;
+
+	//Compute billboards on a task and apply them in the next TG_PostUpdateWork. Launched from this
+	//component's tick, that is the same frame. Under ip.CentralPointUpdate 1 the subsystem launches it
+	//after the tick groups, so it lands in the next frame's TG_PostUpdateWork, one frame further behind
+	//the camera. Time sliced updates and ip.AsyncBillboardUpdate 0 fall back to the synchronous update.
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		bool bAsyncUpdate = false;
+
+	//Camera movement (cm, degrees) below which ticks skip the update
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		float CameraUpdateTolerance = 0.01;
+
+	//Render state invalidations issued by the last UpdateTransform, 1 when anything changed
+	UPROPERTY(VisibleAnywhere, Transient, Category = "InstancedPoint")
+		int32 RenderStateUpdatesLastTick = 0;
+
 	UPROPERTY(BlueprintAssignable)
 		FEOnCullingName EOnCullingName;
 
+	//Instances whose name came in range (Entered) or left it (Exited) during one update
+	UPROPERTY(BlueprintAssignable)
+		FOnNamesCulled OnNamesCulled;
+
 	UPROPERTY(BlueprintAssignable)
 		FOnSelectPatternCulling OnSelectPatternCulling;
 	UPROPERTY(BlueprintAssignable)
@@ -4,6 +4,9 @@
 
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
+#include "Stats/Stats.h"
+
+DECLARE_STATS_GROUP(TEXT("InstancedPoint"), STATGROUP_InstancedPoint, STATCAT_Advanced);
 
 class FInstancedPointModule : public IModuleInterface
 {
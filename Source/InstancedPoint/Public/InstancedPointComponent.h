@@ -4,6 +4,11 @@
 
 #include "CoreMinimal.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "PointScreenProjector.h"
+#include "PointLocationCache.h"
+#include "PointBillboardUpdate.h"
+#include "PointViewGate.h"
+#include "PointInstanceChangeTracking.h"
 #include "InstancedPointComponent.generated.h"
 
 /**
@@ -23,6 +28,29 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
 	void UpdateTransform();
 
+	//View gate, true when this frame needs an update
+	bool ShouldUpdateThisFrame();
+
+	//Updated by UInstancedPointSubsystem instead of its own tick
+	bool IsCentrallyUpdated() const { return bCentralUpdate; }
+
+	virtual void RegisterComponentTickFunctions(bool bRegister) override;
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+
+	//Update on the next tick even if the camera did not move
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+	void ForceTransformUpdate() { ViewGate.ForceUpdate(); }
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+	int32 GetSkippedUpdateCount() const { return ViewGate.GetNumSkipped(); }
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+	int32 GetRunUpdateCount() const { return ViewGate.GetNumUpdated(); }
+
+	//Instance adds, removes and moves invalidate the location cache
+	POINT_INSTANCE_CHANGE_OVERRIDES();
+
 //	//лԶн¼
 //	DECLARE_EVENT(UInstancedPointComponent, FChangeDistanceType)
 //	FChangeDistanceType& DisChanged() { return ChangeDistanceType;}
@@ -38,5 +66,32 @@ public:
 
 	bool bSetBoundSize = false;
 
+	//Camera movement (cm, degrees) below which ticks skip the update
+	UPROPERTY(EditAnywhere, Category = "InstancedPoint")
+		float CameraUpdateTolerance = 0.01;
+
+protected:
+	void NotifyInstancesChanged(bool bInstancesRemoved);
+
+	void InvalidateLocationCache();
+
+	FPointScreenProjector ScreenProjector;
+
+	FPointLocationCache LocationCache;
+
+	FPointViewGate ViewGate;
+
+	//Set while billboard transforms are committed, these never move an instance
+	bool bCommittingInstanceTransforms = false;
+
+	TArray<FTransform> NewInstanceTransforms;
+	//Every instance, in index order
+	TArray<int32> BillboardCandidates;
+
+	TArray<FPointBillboardChunkScratch> BillboardScratch;
+
+	FPointBillboardOutput BillboardOutput;
+
+	bool bCentralUpdate = false;
 
 };
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "PointViewState.h"
+#include "PointBillboardUpdate.h"
+#include "InstancedPointSubsystem.generated.h"
+
+class UHInstancedPointComponent;
+class UInstancedPointComponent;
+
+/**
+ * World wide services shared by the point components of a world.
+ * Updates every registered point component from one tick, with the billboard
+ * compute of all of them in a single parallel dispatch (see ip.CentralPointUpdate).
+ * Captures the player's view once per frame for all of them, and hands out the
+ * per frame budget of time sliced billboard updates, see
+ * ip.BillboardBudgetMicroseconds and ip.BillboardBudgetInstances.
+ */
+UCLASS()
+class INSTANCEDPOINT_API UInstancedPointSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	//False when central updates are off, the component then keeps its own tick
+	bool RegisterPointComponent(UHInstancedPointComponent* Component);
+	bool RegisterPointComponent(UInstancedPointComponent* Component);
+
+	void UnregisterPointComponent(UHInstancedPointComponent* Component);
+	void UnregisterPointComponent(UInstancedPointComponent* Component);
+
+	//~ Begin FTickableGameObject Interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override { return ETickableTickType::Conditional; }
+	virtual bool IsTickable() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	virtual TStatId GetStatId() const override;
+	//~ End FTickableGameObject Interface
+
+
+	//This frame's view, captured on first use. Read only, shared by every point component of the world.
+	const FPointViewState& GetViewState();
+
+	//Valid view state of the world of WorldContext, or null when there is no view to billboard against
+	static const FPointViewState* FindViewState(const UObject* WorldContext);
+
+	//Use this view instead of the first player's, until cleared
+	void SetViewStateOverride(const FPointViewState& InViewState);
+
+	void ClearViewStateOverride();
+
+	//Share of this frame's budget for one component, the rest split evenly between the
+	//components still expected to run this frame. OutInstances is 0 when not limited.
+	void AcquireBillboardBudget(double& OutMicroseconds, int32& OutInstances);
+
+	//Report what the component actually used, the unused part goes to the ones after it
+	void ReleaseBillboardBudget(double UsedMicroseconds, int32 UsedInstances);
+
+private:
+	void BeginBudgetFrame();
+
+	TArray<TWeakObjectPtr<UHInstancedPointComponent>> HierarchicalComponents;
+
+	TArray<TWeakObjectPtr<UInstancedPointComponent>> InstancedComponents;
+
+	//One compute job: a candidate range of one component
+	struct FComputeJob
+	{
+		UHInstancedPointComponent* Component;
+		int32 Start;
+		int32 End;
+	};
+
+	TArray<UHInstancedPointComponent*> DeferredComponents;
+
+	TArray<FComputeJob> ComputeJobs;
+
+	//Shared by every component, one per job
+	TArray<FPointBillboardChunkScratch> ComputeScratch;
+
+	FPointViewState ViewState;
+
+	bool bViewStateOverride = false;
+
+	uint64 BudgetFrame = 0;
+
+	double RemainingMicroseconds = 0.0;
+
+	int32 RemainingInstances = 0;
+
+	int32 NumServed = 0;
+
+	int32 NumServedLastFrame = 0;
+};
@@ -0,0 +1,256 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointScreenProjector.h"
+#include "PointLocationCache.h"
+
+enum class EPointBillboardAction : uint8
+{
+	//Already collapsed and still out of range
+	None,
+	//Out of pattern range or selected, set to the min transform
+	Collapse,
+	//Projected inside the viewport, use the computed scale
+	Billboard,
+	//Projected outside the viewport
+	OffScreen,
+};
+
+//Result of culling a candidate against the view frustum before projecting it
+enum class EPointFrustumResult : uint8
+{
+	//Off screen, no projection needed
+	Outside,
+	//Needs the per point viewport test
+	Intersect,
+	//On screen with its raised point, only the scale is projected
+	Inside,
+};
+
+struct FPointBillboardParams
+{
+	FVector CameraLocation = FVector::ZeroVector;
+
+	//Camera up * BoundSize
+	FVector UpOffset = FVector::ZeroVector;
+
+	float ScreenSize = 10.0f;
+
+	float PatternCullingDistance = 100000.0f;
+
+	float MinScale = 0.01f;
+
+	//Billboards never grow past it, 0 for no limit
+	float MaxScale = 0.0f;
+
+	int32 SelectedInstanceIndex = INDEX_NONE;
+
+	bool bCulling = true;
+
+	//One EPointFrustumResult per candidate, empty to test every candidate against the viewport
+	TArrayView<const uint8> CandidateFrustum;
+};
+
+//Results of the compute pass, one per candidate and in candidate order
+struct FPointBillboardOutput
+{
+	TArray<uint8> Actions;
+	TArray<float> Scales;
+	TArray<float> Distances;
+
+	void SetNum(int32 Num)
+	{
+		Actions.SetNumUninitialized(Num, false);
+		Scales.SetNumUninitialized(Num, false);
+		Distances.SetNumUninitialized(Num, false);
+	}
+};
+
+/**
+ * Per frame options of the compute pass as compile time flags. ComputeRange picks
+ * the specialisation once per call, so the loop over candidates does not test them.
+ */
+template<bool bInCulling, bool bInHasSelection, bool bInFrustumCulled>
+struct TPointBillboardPolicy
+{
+	//Out of range candidates collapse, off screen ones are reported. Without it every candidate gets its projected scale
+	static constexpr bool bCulling = bInCulling;
+
+	//Params.SelectedInstanceIndex is set, that instance collapses
+	static constexpr bool bHasSelection = bInHasSelection;
+
+	//Params.CandidateFrustum is filled
+	static constexpr bool bFrustumCulled = bInFrustumCulled;
+};
+
+//Which names the apply pass hands to its sink
+enum class EPointNameEmit : uint8
+{
+	//No name updates
+	None,
+	//Shown and off screen instances, with their distance
+	Shown,
+	//As Shown, and collapsed instances through HideName
+	ShownAndCollapsed,
+};
+
+/**
+ * Per frame options of the apply pass as compile time flags, picked once per Apply call.
+ */
+template<bool bInHasSelection, EPointNameEmit InNameEmit>
+struct TPointBillboardApplyPolicy
+{
+	//Params.SelectedInstanceIndex is set, that instance goes to the sink's Select instead of Collapse
+	static constexpr bool bHasSelection = bInHasSelection;
+
+	static constexpr EPointNameEmit NameEmit = InNameEmit;
+};
+
+//Scratch memory owned by one chunk of the compute pass
+struct FPointBillboardChunkScratch
+{
+	TArray<int32> ProjectSlots;
+	TArray<int32> ProjectInstances;
+	TArray<float> ProjectedScales;
+	TArray<uint8> ProjectedInViewport;
+};
+
+/**
+ * The per instance part of the billboard update: distance, culling decision,
+ * projection and scale, for a list of candidate instances. It only reads the
+ * location cache and writes the output slice of its candidate range, so ranges
+ * can run on any thread and the results do not depend on how they were split.
+ */
+struct INSTANCEDPOINT_API FPointBillboardUpdate
+{
+	//Dispatches to the ComputeRangeKernel matching Params
+	static void ComputeRange(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 Start, int32 End, FPointBillboardChunkScratch& Scratch, FPointBillboardOutput& Output);
+
+	//Split the candidates into NumChunks ranges, in parallel when NumChunks > 1
+	static void Compute(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 NumChunks, TArray<FPointBillboardChunkScratch>& Scratch, FPointBillboardOutput& Output);
+
+	//Number of chunks to use for NumCandidates instances, 1 when the parallel update is off
+	static int32 GetNumChunks(int32 NumCandidates, bool bAllowParallel);
+
+	//ip.ParallelBillboardUpdate and the platform allow running on the task graph
+	static bool IsParallelEnabled();
+
+	//Facing the controller. With bLockZ the billboards stay upright and only turn around Z
+	static FRotator MakeBillboardRotator(bool bLockZ, const FVector& ControllerForward, const FVector& ControllerUp);
+
+	/**
+	 * Hand the compute output to Sink in candidate order, on the thread that owns the instances.
+	 * The sink does the writes and provides
+	 *	Collapse(int32 InstIndex, const FVector& Location)
+	 *	Billboard(int32 InstIndex, const FVector& Location, float Scale)
+	 *	OffScreen(int32 InstIndex, const FVector& Location)
+	 *	Select(int32 InstIndex, const FVector& Location, float Distance)
+	 *	Name(int32 InstIndex, const FVector& Location, float Distance)
+	 *	HideName(int32 InstIndex)
+	 */
+	template<typename SinkType>
+	static void Apply(const FPointBillboardParams& Params, EPointNameEmit NameEmit, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, const FPointBillboardOutput& Output, SinkType& Sink);
+
+	template<typename PolicyType, typename SinkType>
+	static void ApplyKernel(const FPointBillboardParams& Params, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, const FPointBillboardOutput& Output, SinkType& Sink);
+
+	template<typename PolicyType>
+	static void ComputeRangeKernel(const FPointBillboardParams& Params, const FPointScreenProjector& Projector, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, int32 Start, int32 End, FPointBillboardChunkScratch& Scratch, FPointBillboardOutput& Output);
+
+	template<bool bLockZ>
+	static FRotator MakeBillboardRotator(const FVector& ControllerForward, const FVector& ControllerUp);
+};
+
+template<typename SinkType>
+void FPointBillboardUpdate::Apply(const FPointBillboardParams& Params, EPointNameEmit NameEmit, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, const FPointBillboardOutput& Output, SinkType& Sink)
+{
+	if (Params.SelectedInstanceIndex != INDEX_NONE)
+	{
+		switch (NameEmit)
+		{
+		case EPointNameEmit::None:
+			ApplyKernel<TPointBillboardApplyPolicy<true, EPointNameEmit::None>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		case EPointNameEmit::Shown:
+			ApplyKernel<TPointBillboardApplyPolicy<true, EPointNameEmit::Shown>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		default:
+			ApplyKernel<TPointBillboardApplyPolicy<true, EPointNameEmit::ShownAndCollapsed>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		}
+	}
+	else
+	{
+		switch (NameEmit)
+		{
+		case EPointNameEmit::None:
+			ApplyKernel<TPointBillboardApplyPolicy<false, EPointNameEmit::None>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		case EPointNameEmit::Shown:
+			ApplyKernel<TPointBillboardApplyPolicy<false, EPointNameEmit::Shown>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		default:
+			ApplyKernel<TPointBillboardApplyPolicy<false, EPointNameEmit::ShownAndCollapsed>>(Params, Locations, Candidates, Output, Sink);
+			break;
+		}
+	}
+}
+
+template<typename PolicyType, typename SinkType>
+void FPointBillboardUpdate::ApplyKernel(const FPointBillboardParams& Params, const FPointLocationCache& Locations, TArrayView<const int32> Candidates, const FPointBillboardOutput& Output, SinkType& Sink)
+{
+	const bool bEmitNames = PolicyType::NameEmit != EPointNameEmit::None;
+	const bool bEmitCollapsedNames = PolicyType::NameEmit == EPointNameEmit::ShownAndCollapsed;
+
+	for (int32 k = 0; k < Candidates.Num(); k++)
+	{
+		const int32 i = Candidates[k];
+		switch ((EPointBillboardAction)Output.Actions[k])
+		{
+		case EPointBillboardAction::None:
+			if (bEmitCollapsedNames)
+			{
+				Sink.HideName(i);
+			}
+			break;
+
+		case EPointBillboardAction::Collapse:
+			//The compute pass always collapses the selected instance
+			if (PolicyType::bHasSelection && i == Params.SelectedInstanceIndex)
+			{
+				Sink.Select(i, Locations.GetLocation(i), Output.Distances[k]);
+				break;
+			}
+			Sink.Collapse(i, Locations.GetLocation(i));
+			if (bEmitCollapsedNames)
+			{
+				Sink.HideName(i);
+			}
+			break;
+
+		case EPointBillboardAction::Billboard:
+		{
+			const FVector Location = Locations.GetLocation(i);
+			Sink.Billboard(i, Location, Output.Scales[k]);
+			if (bEmitNames)
+			{
+				Sink.Name(i, Location, Output.Distances[k]);
+			}
+			break;
+		}
+
+		default:
+		{
+			const FVector Location = Locations.GetLocation(i);
+			Sink.OffScreen(i, Location);
+			if (bEmitNames)
+			{
+				Sink.Name(i, Location, Output.Distances[k]);
+			}
+			break;
+		}
+		}
+	}
+}
@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/StringView.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+struct FPointDataset;
+
+/**
+ * Binary point file, little endian, every offset from the start of the file:
+ *   FPointBinaryHeader
+ *   FPointBinaryType[NumTypes]
+ *   FPointBinaryString[NumAttNames]
+ *   per type, 16 byte aligned: int32 point indices, ascending
+ *                              FVector positions, same order
+ *                              uint32 AttStart[NumPoints + 1], into the type's attributes
+ *                              FPointBinaryAttribute[NumAttributes]
+ *   UTF-8 string data, not null terminated
+ */
+struct FPointBinaryHeader
+{
+	static constexpr uint32 MagicValue = 0x42545049; // "IPTB"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	uint32 NumTypes = 0;
+	uint32 NumAttNames = 0;
+	uint64 TypeTableOffset = 0;
+	uint64 AttNameTableOffset = 0;
+	uint64 StringDataOffset = 0;
+	uint64 StringDataSize = 0;
+};
+
+//Offset into the string data
+struct FPointBinaryString
+{
+	uint64 Offset = 0;
+	uint32 Length = 0;
+	uint32 Padding = 0;
+};
+
+struct FPointBinaryType
+{
+	FPointBinaryString Name;
+	uint32 NumPoints = 0;
+	uint32 NumAttributes = 0;
+	uint64 IndicesOffset = 0;
+	uint64 PositionsOffset = 0;
+	uint64 AttStartOffset = 0;
+	uint64 AttributesOffset = 0;
+};
+
+struct FPointBinaryAttribute
+{
+	//Into the attribute name table
+	uint32 NameId = 0;
+	uint32 ValueLength = 0;
+	uint64 ValueOffset = 0;
+};
+
+/**
+ * A binary point file mapped in memory. Opening only checks the tables, the
+ * positions and strings are read in place from the mapped pages, so the views
+ * returned stay valid until Close.
+ */
+class INSTANCEDPOINT_API FPointBinaryDataset
+{
+public:
+	FPointBinaryDataset();
+	~FPointBinaryDataset();
+
+	bool Open(const FString& Path);
+
+	void Close();
+
+	bool IsOpen() const { return Data != nullptr; }
+
+	int32 GetNumTypes() const { return Header ? Header->NumTypes : 0; }
+
+	//INDEX_NONE when the file has no such type
+	int32 FindType(const FString& Type) const;
+
+	FUtf8StringView GetTypeName(int32 TypeId) const { return GetString(Types[TypeId].Name); }
+
+	TArrayView<const int32> GetIndices(int32 TypeId) const;
+
+	//Ready to copy to instance locations as is
+	TArrayView<const FVector> GetPositions(int32 TypeId) const;
+
+	//Slot of PointIndex in GetIndices and GetPositions, INDEX_NONE if missing
+	int32 FindSlot(int32 TypeId, int32 PointIndex) const;
+
+	TArrayView<const FPointBinaryAttribute> GetAttributes(int32 TypeId, int32 Slot) const;
+
+	FUtf8StringView GetAttributeName(const FPointBinaryAttribute& Attribute) const;
+
+	FUtf8StringView GetAttributeValue(const FPointBinaryAttribute& Attribute) const;
+
+	//Attributes of a point copied to a map, for Blueprint
+	TMap<FString, FString> GetAttributeMap(int32 TypeId, int32 Slot) const;
+
+	//Every type of a parsed JSON dataset, see FPointDataset
+	static bool Write(const FPointDataset& Dataset, const FString& Path);
+
+private:
+	FUtf8StringView GetString(const FPointBinaryString& String) const;
+
+	bool Validate() const;
+
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+
+	const uint8* Data = nullptr;
+	uint64 Size = 0;
+
+	const FPointBinaryHeader* Header = nullptr;
+	const FPointBinaryType* Types = nullptr;
+	const FPointBinaryString* AttNames = nullptr;
+};
@@ -0,0 +1,114 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ConvexVolume.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "PointLocationCache.h"
+
+/**
+ * Walks the cluster tree of a HISM component against the view frustum so whole
+ * clusters are accepted or rejected at once. The tree only provides the grouping
+ * of the instances, node bounds are rebuilt from the cached instance locations
+ * whenever the cache or the tree layout changes, so they hold the billboard locations
+ * whatever scale the instances currently have. A new tree with the same layout, as
+ * built after scale changes or padded by PadClusterTree, keeps the current bounds.
+ */
+struct INSTANCEDPOINT_API FPointClusterCuller
+{
+public:
+	//False when the component has no tree matching its instances, the caller then tests every instance
+	bool Update(const UHierarchicalInstancedStaticMeshComponent& Component, const FPointLocationCache& Locations);
+
+	//Locations changed, node bounds are rebuilt by the next Update
+	void Invalidate() { bBoundsDirty = true; }
+
+	bool IsValid() const { return NodeBounds.Num() > 0; }
+
+	//Number of times the component replaced its cluster tree
+	int32 GetNumTreeChanges() const { return NumTreeChanges; }
+
+	/**
+	 * Replaces the component's cluster tree by a copy whose node bounds hold every
+	 * instance at any rotation and any scale up to MaxScale, so billboard updates
+	 * that keep the locations never outgrow it. False when the tree does not cover
+	 * every instance yet.
+	 */
+	static bool PadClusterTree(UHierarchicalInstancedStaticMeshComponent& Component, const FPointLocationCache& Locations, float MinScale, float MaxScale);
+
+	/**
+	 * Calls Function(InstanceIndex, bFullyInside) for every instance of the clusters
+	 * that touch both the sphere and the frustum. bFullyInside is true when the
+	 * cluster grown by Margin is inside the frustum, so a point and anything within
+	 * Margin of it are on screen. Returns the number of nodes visited.
+	 */
+	template<typename FunctionType>
+	int32 ForEachVisible(const FConvexVolume& TranslatedFrustum, const FVector& ViewOrigin, const FVector& Center, double Radius, float Margin, FunctionType&& Function) const
+	{
+		if (!IsValid())
+		{
+			return 0;
+		}
+
+		const TArray<FClusterNode>& Nodes = *ClusterTree;
+		const double RadiusSquared = Radius * Radius;
+		int32 NumVisited = 0;
+
+		TArray<int32, TInlineAllocator<64>> Stack;
+		Stack.Add(0);
+		while (Stack.Num() > 0)
+		{
+			const int32 NodeIndex = Stack.Pop(false);
+			const FClusterNode& Node = Nodes[NodeIndex];
+			const FBox& Bounds = NodeBounds[NodeIndex];
+			NumVisited++;
+
+			if (Bounds.ComputeSquaredDistanceToPoint(Center) > RadiusSquared)
+			{
+				continue;
+			}
+
+			bool bFullyInside = false;
+			if (!TranslatedFrustum.IntersectBox(Bounds.GetCenter() - ViewOrigin, Bounds.GetExtent() + FVector(Margin), bFullyInside))
+			{
+				continue;
+			}
+
+			if (bFullyInside || Node.FirstChild < 0)
+			{
+				for (int32 SortedIndex = Node.FirstInstance; SortedIndex <= Node.LastInstance; SortedIndex++)
+				{
+					Function(SortedInstances[SortedIndex], bFullyInside);
+				}
+				continue;
+			}
+
+			for (int32 Child = Node.FirstChild; Child <= Node.LastChild; Child++)
+			{
+				Stack.Add(Child);
+			}
+		}
+
+		return NumVisited;
+	}
+
+private:
+	//Nodes and instance order match the tree the bounds were built for, only the node bounds may differ
+	bool HasSameLayout(const TArray<FClusterNode>& Nodes, const TArray<int32>& InSortedInstances) const;
+
+	//Bounds of the cached locations under each node, false when the tree does not match the instances
+	static bool BuildNodeBounds(const TArray<FClusterNode>& Nodes, const TArray<int32>& InSortedInstances, const FPointLocationCache& Locations, TArray<FBox>& OutBounds);
+
+	TSharedPtr<TArray<FClusterNode>, ESPMode::ThreadSafe> ClusterTree;
+
+	//Copy of the component's SortedInstances taken with ClusterTree, the two always match
+	TArray<int32> SortedInstances;
+
+	//World space bounds of the cached locations under each node
+	TArray<FBox> NodeBounds;
+
+	bool bBoundsDirty = true;
+
+	int32 NumTreeChanges = 0;
+};
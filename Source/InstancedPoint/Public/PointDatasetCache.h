@@ -0,0 +1,150 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+
+class FPointJsonStream;
+
+//Shared with a load running on another thread
+struct FPointDatasetLoadProgress
+{
+	TAtomic<int64> BytesRead{ 0 };
+	TAtomic<int64> TotalBytes{ 0 };
+
+	//Set to stop the load, which then fails
+	TAtomic<bool> bCancelled{ false };
+};
+
+//The points of one type of a dataset, in file order
+struct INSTANCEDPOINT_API FPointDatasetType
+{
+public:
+	int32 Num() const { return PointIndices.Num(); }
+
+	//Position of a point index in the arrays below, INDEX_NONE if the type has no such point
+	int32 FindSlot(int32 PointIndex) const;
+
+	//Attributes of the point in Slot as a map
+	TMap<FString, FString> GetAttributes(int32 Slot, const TArray<FString>& AttNames) const;
+
+public:
+	TArray<int32> PointIndices;
+	TArray<FVector> Locations;
+
+	//Attributes of Slot are AttKeys and AttValues from AttStart[Slot] to AttStart[Slot + 1]
+	TArray<int32> AttStart;
+
+	//Into FPointDataset::AttNames
+	TArray<int32> AttKeys;
+	TArray<FString> AttValues;
+
+	//Point index to slot, empty when every point index is its slot
+	TMap<int32, int32> Slots;
+};
+
+/**
+ * A parsed point file, {Type: {Index: {"Loc": {"X", "Y", "Z"}, "Att": {..}}}}, and the
+ * {Key: {"InfoMap": {..}}} objects of area files, read in one pass of FPointJsonStream.
+ * Immutable once loaded, shared by every caller through FPointDatasetCache.
+ */
+struct INSTANCEDPOINT_API FPointDataset
+{
+public:
+	//Progress, when given, is updated as the file is read and can cancel the load
+	bool Load(const FString& Path, FPointDatasetLoadProgress* Progress = nullptr);
+
+	const FPointDatasetType* FindType(const FString& Type) const { return Types.Find(Type); }
+
+	//{"X": .., "Y": .., "Z": ..}, missing axes are 0
+	static bool ReadLoc(FPointJsonStream& Stream, FVector& OutLoc);
+
+public:
+	TMap<FString, FPointDatasetType> Types;
+
+	TMap<FString, TMap<FString, FString>> InfoMaps;
+
+	//Attribute keys, shared by every point
+	TArray<FString> AttNames;
+
+	//Bytes held, counted against ip.PointDatasetCacheMB
+	SIZE_T AllocatedSize = 0;
+};
+
+typedef TSharedPtr<const FPointDataset, ESPMode::ThreadSafe> FPointDatasetPtr;
+
+//Point indices and locations of one type, streamed without parsing the rest of the file
+struct INSTANCEDPOINT_API FPointTypeLocations
+{
+public:
+	TArray<int32> PointIndices;
+	TArray<FVector> Locations;
+
+	//Bytes held, counted against ip.PointDatasetCacheMB
+	SIZE_T AllocatedSize = 0;
+};
+
+typedef TSharedPtr<const FPointTypeLocations, ESPMode::ThreadSafe> FPointTypeLocationsPtr;
+
+//Fills the point indices and locations of a type from the file at a full path, false if it cannot
+typedef TFunctionRef<bool(const FString& FullPath, TArray<int32>& OutIndices, TArray<FVector>& OutLocations)> FPointTypeLocationsReader;
+
+/**
+ * Parsed datasets by full path, and the locations of single types by full path and type.
+ * A file is read again only when its time stamp changes, the least recently used entries
+ * are dropped past ip.PointDatasetCacheMB. Safe to use from any thread.
+ */
+class INSTANCEDPOINT_API FPointDatasetCache
+{
+public:
+	static FPointDatasetCache& Get();
+
+	//Parses the file on the first call and after it changed, null if it cannot be read or the load was cancelled
+	FPointDatasetPtr Find(const FString& Path, FPointDatasetLoadProgress* Progress = nullptr);
+
+	//Only a dataset already parsed and still matching the file, never reads it
+	FPointDatasetPtr FindCached(const FString& Path);
+
+	//Read through ReadLocations on the first call and after the file changed, null if the file is missing.
+	//Empty when ReadLocations failed
+	FPointTypeLocationsPtr FindTypeLocations(const FString& Path, const FString& Type, FPointTypeLocationsReader ReadLocations);
+
+	void Evict(const FString& Path);
+
+	void Empty();
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	//Least recently used first, until under the cap. The most recent dataset always stays
+	void Trim();
+
+	void UpdateMemoryStat();
+
+	//Of every entry, Lock held
+	SIZE_T GetAllocatedSizeLocked() const;
+
+	struct FEntry
+	{
+		FPointDatasetPtr Dataset;
+		FDateTime TimeStamp;
+		uint64 LastUse = 0;
+	};
+
+	struct FTypeLocationsEntry
+	{
+		FPointTypeLocationsPtr Locations;
+		FDateTime TimeStamp;
+		uint64 LastUse = 0;
+	};
+
+	TMap<FString, FEntry> Entries;
+
+	//By full path and type
+	TMap<TPair<FString, FString>, FTypeLocationsEntry> TypeEntries;
+
+	uint64 UseCounter = 0;
+
+	mutable FCriticalSection Lock;
+};
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintAsyncActionBase.h"
+#include "Containers/Ticker.h"
+#include "PointDatasetCache.h"
+#include "PointDatasetLoadAction.generated.h"
+
+class UHInstancedPointComponent;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnPointDatasetLoad, float, Progress, int32, NumInstances);
+
+/**
+ * Loads the points of one type into a component without stalling the game thread.
+ * The file is parsed on a worker thread through FPointDatasetCache, then the
+ * instances are added InstancesPerFrame at a time with the component in bulk load,
+ * and its cluster tree is built once at the end.
+ */
+UCLASS()
+class INSTANCEDPOINT_API UPointDatasetLoadAction : public UBlueprintAsyncActionBase
+{
+	GENERATED_BODY()
+
+public:
+	//Progress goes to 0.5 while parsing and to 1 while adding instances
+	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", WorldContext = "WorldContextObject", DisplayName = "LoadPointsAsync", Keywords = "Load Points Async"), Category = "PointLib")
+		static UPointDatasetLoadAction* LoadPointsAsync(UObject* WorldContextObject, UHInstancedPointComponent* Component, FString Type, FString DataPath, int32 InstancesPerFrame = 5000);
+
+	virtual void Activate() override;
+
+	//Collected mid-load, e.g. with its game instance: the component still leaves bulk load
+	virtual void BeginDestroy() override;
+
+	//Stops parsing or adding, nothing is broadcast after it. Instances already added stay
+	UFUNCTION(BlueprintCallable, Category = "PointLib")
+		void Cancel();
+
+	UPROPERTY(BlueprintAssignable)
+		FOnPointDatasetLoad OnProgress;
+
+	UPROPERTY(BlueprintAssignable)
+		FOnPointDatasetLoad OnCompleted;
+
+	//The file could not be read, has no such type, or the component went away
+	UPROPERTY(BlueprintAssignable)
+		FOnPointDatasetLoad OnFailed;
+
+private:
+	bool Tick(float DeltaTime);
+
+	//The component's world is torn down, stop before its instances are
+	void OnWorldCleanup(UWorld* World, bool bSessionEnded, bool bCleanupResources);
+
+	void BroadcastProgress(float Progress);
+
+	//Ends the bulk load and lets the action be collected
+	void Finish();
+
+	//Stops the parsing task and the ticker and ends the bulk load. Safe to call more than once
+	void EndLoad();
+
+	//Shared with the parsing task, which may outlive the action when cancelled
+	struct FLoadState
+	{
+		FPointDatasetLoadProgress Progress;
+		FPointDatasetPtr Dataset;
+		TAtomic<bool> bParsed{ false };
+	};
+
+	TSharedPtr<FLoadState, ESPMode::ThreadSafe> State;
+
+	TWeakObjectPtr<UHInstancedPointComponent> Component;
+
+	FString Type;
+
+	FString DataPath;
+
+	int32 InstancesPerFrame = 5000;
+
+	FPointDatasetPtr Dataset;
+
+	const FPointDatasetType* PointType = nullptr;
+
+	int32 NextSlot = 0;
+
+	TArray<FTransform> Transforms;
+
+	bool bAdding = false;
+
+	bool bFinished = false;
+
+	float LastProgress = -1.0f;
+
+	FDelegateHandle TickerHandle;
+
+	FDelegateHandle WorldCleanupHandle;
+};
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Overrides of every UInstancedStaticMeshComponent entry point that adds, removes or moves instances,
+ * and of OnUpdateTransform, shared by the point components. Each one calls the class's
+ * NotifyInstancesChanged(bool bInstancesRemoved) and forwards to Super, so the base class and the
+ * hook are the only things that differ between them. Transform updates made while the class's
+ * bCommittingInstanceTransforms is set are its own billboard commit and are not reported.
+ *
+ * A UCLASS cannot derive from a class template, so the overrides are stamped into the class body:
+ *
+ *	POINT_INSTANCE_CHANGE_OVERRIDES();
+ *
+ * The access is public after it.
+ */
+#define POINT_INSTANCE_CHANGE_OVERRIDES() \
+public: \
+	virtual int32 AddInstance(const FTransform& InstanceTransform) override \
+	{ \
+		NotifyInstancesChanged(false); \
+		return Super::AddInstance(InstanceTransform); \
+	} \
+	virtual TArray<int32> AddInstances(const TArray<FTransform>& InstanceTransforms, bool bShouldReturnIndices) override \
+	{ \
+		NotifyInstancesChanged(false); \
+		return Super::AddInstances(InstanceTransforms, bShouldReturnIndices); \
+	} \
+	virtual bool RemoveInstance(int32 InstanceIndex) override \
+	{ \
+		NotifyInstancesChanged(true); \
+		return Super::RemoveInstance(InstanceIndex); \
+	} \
+	virtual bool RemoveInstances(const TArray<int32>& InstancesToRemove) override \
+	{ \
+		NotifyInstancesChanged(true); \
+		return Super::RemoveInstances(InstancesToRemove); \
+	} \
+	virtual void ClearInstances() override \
+	{ \
+		NotifyInstancesChanged(true); \
+		Super::ClearInstances(); \
+	} \
+	virtual bool UpdateInstanceTransform(int32 InstanceIndex, const FTransform& NewInstanceTransform, bool bWorldSpace = false, bool bMarkRenderStateDirty = false, bool bTeleport = false) override \
+	{ \
+		if (!bCommittingInstanceTransforms) \
+		{ \
+			NotifyInstancesChanged(false); \
+		} \
+		return Super::UpdateInstanceTransform(InstanceIndex, NewInstanceTransform, bWorldSpace, bMarkRenderStateDirty, bTeleport); \
+	} \
+	virtual bool BatchUpdateInstancesTransforms(int32 StartInstanceIndex, const TArray<FTransform>& NewInstancesTransforms, bool bWorldSpace = false, bool bMarkRenderStateDirty = false, bool bTeleport = false) override \
+	{ \
+		if (!bCommittingInstanceTransforms) \
+		{ \
+			NotifyInstancesChanged(false); \
+		} \
+		return Super::BatchUpdateInstancesTransforms(StartInstanceIndex, NewInstancesTransforms, bWorldSpace, bMarkRenderStateDirty, bTeleport); \
+	} \
+	virtual bool BatchUpdateInstancesTransform(int32 StartInstanceIndex, int32 NumInstances, const FTransform& NewInstancesTransform, bool bWorldSpace = false, bool bMarkRenderStateDirty = false, bool bTeleport = false) override \
+	{ \
+		if (!bCommittingInstanceTransforms) \
+		{ \
+			NotifyInstancesChanged(false); \
+		} \
+		return Super::BatchUpdateInstancesTransform(StartInstanceIndex, NumInstances, NewInstancesTransform, bWorldSpace, bMarkRenderStateDirty, bTeleport); \
+	} \
+protected: \
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport = ETeleportType::None) override \
+	{ \
+		Super::OnUpdateTransform(UpdateTransformFlags, Teleport); \
+		NotifyInstancesChanged(false); \
+	} \
+public:
@@ -0,0 +1,88 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UInstancedStaticMeshComponent;
+
+/**
+ * Sends billboard transforms and per instance custom data straight to the render
+ * instance buffer of an ISM. The front buffer holds the rotation and scale last sent
+ * for every instance, the back buffer this update's changes; instances whose state
+ * did not change are dropped, the rest are coalesced into ranges of consecutive
+ * instances and go to the render thread in one command buffer without recreating
+ * the render state.
+ */
+struct INSTANCEDPOINT_API FPointInstanceUploadBuffer
+{
+public:
+	//Consecutive instances [Start, End)
+	struct FInstanceRange
+	{
+		int32 Start;
+		int32 End;
+	};
+
+	//Forget what was sent, the next Submit sends every staged instance
+	void Reset(int32 NumInstances);
+
+	int32 Num() const { return Submitted.Num(); }
+
+	//Stage the world transform of an instance, skipped when it matches the one last sent
+	void Stage(int32 InstIndex, const FTransform& WorldTransform);
+
+	//Stage one custom data value of an instance. Values never move the bounds, they can be sent with any tree
+	void StageCustomData(int32 InstIndex, int32 DataIndex, float Value);
+
+	int32 NumStaged() const { return StagedTransforms.Num() + StagedCustomData.Num(); }
+
+	/**
+	 * Writes the staged transforms and custom data to PerInstanceSMData, PerInstanceSMCustomData
+	 * and the render instance buffer, then makes them the sent state. The caller keeps the bounds
+	 * valid: only rotation and scale may change. Returns the number of instances sent.
+	 */
+	int32 Submit(UInstancedStaticMeshComponent& Component);
+
+	//Ranges of consecutive instances [Start, End) sent by the last Submit, ascending and apart
+	TArrayView<const FInstanceRange> GetSubmittedRanges() const { return DirtyRanges; }
+
+	//The component has render instance data to update in place
+	static bool CanSubmit(const UInstancedStaticMeshComponent& Component);
+
+private:
+	struct FInstanceState
+	{
+		FQuat Rotation = FQuat::Identity;
+
+		//Negative until sent once
+		float Scale = -1.0f;
+	};
+
+	struct FStagedTransform
+	{
+		int32 InstIndex;
+		FTransform Transform;
+	};
+
+	struct FStagedCustomData
+	{
+		int32 InstIndex;
+		int32 DataIndex;
+		float Value;
+	};
+
+	//Order the staged writes by instance and merge them into DirtyRanges
+	void CoalesceStaged();
+
+	TArray<FInstanceState> Submitted;
+
+	//Staged in ascending instance order unless the flags say otherwise
+	TArray<FStagedTransform> StagedTransforms;
+	TArray<FStagedCustomData> StagedCustomData;
+	bool bTransformsSorted = true;
+	bool bCustomDataSorted = true;
+
+	TArray<FInstanceRange> DirtyRanges;
+	TArray<float> CustomDataScratch;
+};
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Pull reader over a UTF-8 JSON file, read through a fixed size buffer. Values are
+ * read or skipped one at a time as the caller walks the document, nothing is kept
+ * behind the cursor, so memory does not grow with the file. Strings stay UTF-8
+ * until ReadString or GetKeyString asks for them.
+ *
+ *   Stream.BeginObject();
+ *   while (Stream.NextMember())
+ *   {
+ *       Stream.IsKey("Loc") ? ReadLoc(Stream) : Stream.SkipValue();
+ *   }
+ *
+ * Every call returns false once the input is malformed, see HasError.
+ */
+class INSTANCEDPOINT_API FPointJsonStream
+{
+public:
+	explicit FPointJsonStream(FArchive& InArchive, int32 BufferSize = 64 * 1024);
+
+	//Reads the '{' of the next value
+	bool BeginObject();
+
+	//Reads the key of the next member of the innermost object and its ':', the value is next.
+	//False at the closing '}', which is read too.
+	bool NextMember();
+
+	//Key of the last NextMember, compared as UTF-8
+	bool IsKey(const ANSICHAR* Name) const;
+
+	//Key of the last NextMember as a non negative integer, "12" gives 12
+	bool GetKeyAsIndex(int32& OutIndex) const;
+
+	FString GetKeyString() const;
+
+	//The next value is an object
+	bool IsObjectNext();
+
+	//A number, or a string holding a number
+	bool ReadNumber(double& OutNumber);
+
+	//A string, or the text of a number or literal. Objects and arrays are skipped
+	bool ReadString(FString& OutString);
+
+	//Skips the next value and everything nested in it
+	bool SkipValue();
+
+	bool HasError() const { return bError; }
+
+	int64 GetBytesRead() const { return BufferOffset + BufferPos; }
+
+private:
+	FORCEINLINE int32 PeekByte()
+	{
+		return BufferPos < BufferEnd ? Buffer[BufferPos] : RefillAndPeek();
+	}
+
+	FORCEINLINE int32 ReadByte()
+	{
+		const int32 Byte = PeekByte();
+		BufferPos += Byte >= 0 ? 1 : 0;
+		return Byte;
+	}
+
+	//Next byte that is not whitespace, -1 at the end
+	int32 PeekToken();
+
+	int32 RefillAndPeek();
+
+	//Quoted string to null terminated UTF-8 with the escapes decoded
+	bool ReadRawString(TArray<ANSICHAR>& OutString);
+
+	//Number or literal text to null terminated ANSI
+	bool ReadRawLiteral(TArray<ANSICHAR>& OutLiteral);
+
+	bool SkipString();
+
+	bool Fail();
+
+	FArchive& Archive;
+
+	TArray<uint8> Buffer;
+	int32 BufferPos = 0;
+	int32 BufferEnd = 0;
+
+	//File offset of Buffer[0]
+	int64 BufferOffset = 0;
+
+	TArray<ANSICHAR> Key;
+	TArray<ANSICHAR> Scratch;
+
+	//One per open object, true until its first member is read
+	TArray<bool> FirstMember;
+
+	bool bError = false;
+};
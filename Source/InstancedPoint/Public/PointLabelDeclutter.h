@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Picks the labels to draw out of overlapping candidates. Candidates are ordered
+ * by a counting sort on quantized priority, then placed greedily on a coarse
+ * screen occupancy grid: a label is kept when none of its cells is taken. The
+ * cost is linear in the number of candidates for a bounded label size.
+ */
+struct INSTANCEDPOINT_API FPointLabelDeclutter
+{
+public:
+	static const int32 NumPriorityBuckets = 64;
+
+	void Reset();
+
+	//Rect in screen units, Priority in 0..1 with 1 placed first. Priorities up to (NumPriorityBuckets - 1) / NumPriorityBuckets
+	//stay out of the top bucket, so it can be kept for one label. Returns the candidate slot
+	int32 AddCandidate(const FVector2D& Min, const FVector2D& Size, float Priority);
+
+	int32 NumCandidates() const { return Mins.Num(); }
+
+	//Writes the slots of the placed candidates, highest priority first, at most Budget of them (0 for no limit)
+	void Place(const FVector2D& ScreenSize, float CellSize, int32 Budget, TArray<int32>& OutPlaced);
+
+private:
+	bool TryOccupy(const FVector2D& Min, const FVector2D& Size);
+
+	TArray<FVector2D> Mins;
+	TArray<FVector2D> Sizes;
+	TArray<uint8> Buckets;
+
+	TArray<int32> BucketStart;
+	TArray<int32> Order;
+
+	TBitArray<> Occupied;
+	int32 NumCellsX = 0;
+	int32 NumCellsY = 0;
+	float InvCellSize = 1.0f;
+};
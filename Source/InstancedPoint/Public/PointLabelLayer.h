@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/Widget.h"
+#include "Fonts/SlateFontInfo.h"
+#include "PointLabelLayer.generated.h"
+
+class SPointLabelLayer;
+class UHInstancedPointComponent;
+
+/**
+ * UMG wrapper of SPointLabelLayer. Add it full screen to the viewport and give it
+ * the point components whose NameMap entries should be drawn while in name range.
+ */
+UCLASS()
+class INSTANCEDPOINT_API UPointLabelLayer : public UWidget
+{
+	GENERATED_BODY()
+
+public:
+	UPointLabelLayer(const FObjectInitializer& ObjectInitializer);
+
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void AddPointComponent(UHInstancedPointComponent* Component);
+
+	UFUNCTION(BlueprintCallable, Category = "InstancedPoint")
+		void RemovePointComponent(UHInstancedPointComponent* Component);
+
+	UFUNCTION(BlueprintPure, Category = "InstancedPoint")
+		int32 GetNumLabelsDrawn() const;
+
+	virtual void SynchronizeProperties() override;
+	virtual void ReleaseSlateResources(bool bReleaseChildren) override;
+
+#if WITH_EDITOR
+	virtual const FText GetPaletteCategory() override;
+#endif
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FSlateFontInfo Font;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FLinearColor ColorAndOpacity = FLinearColor::White;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FLinearColor ShadowColorAndOpacity = FLinearColor(0.0f, 0.0f, 0.0f, 0.75f);
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FVector2D ShadowOffset = FVector2D(1.0f, 1.0f);
+
+	//Point of the label placed on the point, 0..1 of the label size
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FVector2D Pivot = FVector2D(0.5f, 1.0f);
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		FVector2D ScreenOffset = FVector2D(0.0f, -8.0f);
+
+	//Most labels drawn in one frame, 0 for no limit
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint", meta = (ClampMin = "0"))
+		int32 MaxLabels = 0;
+
+	//Drop labels overlapping one of higher priority, see UHInstancedPointComponent::NamePriorityMap
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint")
+		bool bDeclutter = true;
+
+	//Overlap test resolution, in slate units
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "InstancedPoint", meta = (ClampMin = "1"))
+		float DeclutterCellSize = 8.0f;
+
+protected:
+	virtual TSharedRef<SWidget> RebuildWidget() override;
+
+	TArray<TWeakObjectPtr<UHInstancedPointComponent>> PointComponents;
+
+	TSharedPtr<SPointLabelLayer> LabelLayer;
+};
@@ -8,6 +8,8 @@
 #include "Dom/JsonObject.h"
 #include "PointLibrary.generated.h"
 
+class UHInstancedPointComponent;
+
 /**
  * 
  */
@@ -81,6 +83,39 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "GetPointAttMap", Keywords = "Get Point Attribute Map"), Category = "PointLib")
 		static TMap<FString, FTypePointAtt> GetPointAttMap(FString DataPath);
 
+	//Add one instance per point of Type in a single call, set the component type and bounds. The component keeps
+	//the point index of every instance, see GetPointIndex and GetInstanceIndex. Returns the points added
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "PopulatePointComponent", Keywords = "Populate Point Component Dataset"), Category = "PointLib")
+		static int32 PopulatePointComponent(UHInstancedPointComponent* Component, FString Type, FString DataPath, bool bClearInstances = true);
+
+	//Same as PopulatePointComponent for a binary point file, positions are read from the mapped file
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "PopulatePointComponentFromBinary", Keywords = "Populate Point Component Binary"), Category = "PointLib")
+		static int32 PopulatePointComponentFromBinary(UHInstancedPointComponent* Component, FString Type, FString BinaryPath, bool bClearInstances = true);
+
+	//Write a JSON point file as a binary point file, see FPointBinaryDataset
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "ConvertPointDataToBinary", Keywords = "Convert Point Data Binary"), Category = "PointLib")
+		static bool ConvertPointDataToBinary(FString JsonPath, FString BinaryPath);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "GetBinaryPointLoc", Keywords = "Get Binary Point Location"), Category = "PointLib")
+		static TMap<int32, FVector> GetBinaryPointLocMap(FString Type, FString BinaryPath);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "GetBinaryPointAttribute", Keywords = "Get Binary Point Attribute"), Category = "PointLib")
+		static TMap<FString, FString> GetBinaryPointAttribute(FString Type, int32 Index, FString BinaryPath);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "GetBinaryPointAttMap", Keywords = "Get Binary Point Attribute Map"), Category = "PointLib")
+		static TMap<FString, FTypePointAtt> GetBinaryPointAttMap(FString BinaryPath);
+
+	//Drop the parsed dataset and the streamed type locations, the next call reads the file again
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "EvictPointDataset", Keywords = "Evict Point Dataset Cache"), Category = "PointLib")
+		static void EvictPointDataset(FString DataPath);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "ClearPointDatasetCache", Keywords = "Clear Point Dataset Cache"), Category = "PointLib")
+		static void ClearPointDatasetCache();
+
+	//Locations of the points of Type in file order, OutIndices holds their point index.
+	//Reads the file once through FPointJsonStream, other types are skipped without being parsed.
+	static bool ReadPointLocations(const FString& Type, const FString& DataPath, TArray<int32>& OutIndices, TArray<FVector>& OutLocations);
+
 private:
 		static bool load_json(FString _file_path,TSharedPtr<FJsonObject>&_json_object);
 };
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UInstancedStaticMeshComponent;
+
+/**
+ * World space instance locations kept as contiguous X/Y/Z arrays, plus the
+ * uniform scale last written to each instance. Instance locations never change
+ * while billboarding, so this is rebuilt only when instances are added, removed
+ * or moved, or when the component itself moves.
+ */
+struct INSTANCEDPOINT_API FPointLocationCache
+{
+public:
+	//With a VisibilityCustomDataIndex, instances whose custom data there is 0 get HiddenScale as applied scale
+	void Rebuild(const UInstancedStaticMeshComponent& Component, int32 VisibilityCustomDataIndex = INDEX_NONE, float HiddenScale = 0.0f);
+
+	void MarkDirty() { bDirty = true; }
+
+	bool IsDirty() const { return bDirty; }
+
+	int32 Num() const { return X.Num(); }
+
+	FVector GetLocation(int32 Index) const { return FVector(X[Index], Y[Index], Z[Index]); }
+
+	double DistanceSquared(int32 Index, const FVector& Location) const
+	{
+		const double DX = X[Index] - Location.X;
+		const double DY = Y[Index] - Location.Y;
+		const double DZ = Z[Index] - Location.Z;
+		return DX * DX + DY * DY + DZ * DZ;
+	}
+
+public:
+	TArray<double> X;
+	TArray<double> Y;
+	TArray<double> Z;
+
+	TArray<float> AppliedScale;
+
+private:
+	bool bDirty = true;
+};
@@ -0,0 +1,31 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UMeshComponent;
+
+/**
+ * CPU version of Shaders/Private/InstancedPointBillboard.ush, the billboarding done
+ * by the material when UHInstancedPointComponent::bMaterialBillboard is set.
+ * Each function matches the shader function of the same name, keep both in step.
+ * ip.VerifyMaterialBillboard checks them against the CPU billboard update.
+ */
+struct INSTANCEDPOINT_API FPointMaterialBillboard
+{
+	//InstancedPointScreenScale. ProjectionScaleY is ViewToClip[1][1], (width / height) / tan(FOV / 2)
+	static float ScreenScale(const FVector& PointLocation, const FVector& CameraLocation, const FVector& CameraForward, float ProjectionScaleY, float ViewSizeY, float BaseSize, float ScreenSize);
+
+	//InstancedPointCullingMask
+	static float CullingMask(float Distance, float PatternCullingDistance);
+
+	//InstancedPointBillboardOffset
+	static FVector BillboardOffset(const FVector& LocalPosition, const FVector& CameraForward, const FVector& CameraUp, bool bLockZ, float Scale);
+
+	//Every material of the component calls InstancedPointVisibilityOffset, seen from its IP_CustomDataVisibility parameter
+	static bool MaterialsReadVisibility(const UMeshComponent& Component);
+
+	//InstancedPointMaterialBillboard, with the view values passed in
+	static FVector WorldPositionOffset(const FVector& LocalPosition, const FVector& PointLocation, float BaseSize, const FVector& CameraLocation, const FVector& CameraForward, const FVector& CameraUp, float ProjectionScaleY, float ViewSizeY, float ScreenSize, float PatternCullingDistance, float MaxScale, bool bLockZ);
+};
@@ -0,0 +1,27 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Interface.h"
+#include "PointNameWidget.generated.h"
+
+UINTERFACE(MinimalAPI, Blueprintable)
+class UPointNameWidget : public UInterface
+{
+	GENERATED_BODY()
+};
+
+/**
+ * Implemented by name widgets so pooled instances can be bound to another point
+ * instead of being created for it.
+ */
+class INSTANCEDPOINT_API IPointNameWidget
+{
+	GENERATED_BODY()
+
+public:
+	//The widget now shows the name of point Index
+	UFUNCTION(BlueprintNativeEvent, BlueprintCallable, Category = "InstancedPoint")
+		void SetPointName(const FString& Name, int32 Index);
+};
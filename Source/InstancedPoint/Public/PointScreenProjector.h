@@ -0,0 +1,61 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointLocationCache.h"
+
+class APlayerController;
+struct FConvexVolume;
+
+/**
+ * Projects instance locations to the screen to size screen-constant billboards.
+ * The view-projection matrix is built once per tick by Init, then ProjectScales
+ * handles all instances four at a time.
+ */
+struct INSTANCEDPOINT_API FPointScreenProjector
+{
+public:
+	//Build the view from the player's local player, same data ProjectWorldLocationToScreen uses
+	bool Init(APlayerController* PlayerController, const FVector2D& InViewportSize);
+
+	//Build the view from explicit matrices, for callers without a local player
+	void Init(const FVector& InViewOrigin, const FMatrix& ViewRotationMatrix, const FMatrix& ProjectionMatrix, const FVector2D& InViewRectSize, const FVector2D& InViewportSize);
+
+	bool IsValid() const { return bValid; }
+
+	//Scalar projection, matches APlayerController::ProjectWorldLocationToScreen with bPlayerViewportRelative
+	bool ProjectWorldToScreen(const FVector& WorldLocation, FVector2D& OutScreenLocation) const;
+
+	//View frustum with the near plane, in world space translated by -ViewOrigin
+	void GetTranslatedViewFrustum(FConvexVolume& OutFrustum) const;
+
+	/**
+	 * For every location, projects Location and Location + UpOffset and writes
+	 * ScreenSize / (screen distance between them) to OutScales. OutInViewport is
+	 * non zero when both points are in front of the camera and inside the viewport.
+	 */
+	void ProjectScales(TArrayView<const FVector> Locations, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const;
+
+	//Same as above for every cached location, made view relative in double precision
+	void ProjectScales(const FPointLocationCache& Locations, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const;
+
+	//Same as above for the cached locations at Indices, outputs follow the order of Indices
+	void ProjectScales(const FPointLocationCache& Locations, TArrayView<const int32> Indices, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport) const;
+
+public:
+	FVector ViewOrigin = FVector::ZeroVector;
+
+	//View rotation * projection, applied to locations relative to ViewOrigin
+	FMatrix TranslatedViewProjectionMatrix = FMatrix::Identity;
+
+	FVector2D ViewRectSize = FVector2D::ZeroVector;
+
+	FVector2D ViewportSize = FVector2D::ZeroVector;
+
+private:
+	template<typename FetchRelativeLocationType>
+	void ProjectScalesImpl(int32 Num, const FVector& UpOffset, float ScreenSize, TArray<float>& OutScales, TArray<uint8>& OutInViewport, FetchRelativeLocationType&& FetchRelativeLocation) const;
+
+	bool bValid = false;
+};
@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointLocationCache.h"
+
+/**
+ * Uniform XY grid over the cached instance locations. Instances are stored
+ * sorted by cell, so the instances near a point are found by touching only the
+ * cells around it, whatever the total instance count.
+ */
+struct INSTANCEDPOINT_API FPointSpatialGrid
+{
+public:
+	void Build(const FPointLocationCache& Locations, double InCellSize);
+
+	void Reset();
+
+	bool IsBuilt() const { return CellStart.Num() > 0; }
+
+	double GetCellSize() const { return CellSize; }
+
+	//Calls Function(InstanceIndex) for every instance in a cell that intersects the sphere.
+	//Instances close to the sphere but outside it may be visited too.
+	template<typename FunctionType>
+	void ForEachInSphere(const FVector& Center, double Radius, FunctionType&& Function) const
+	{
+		if (!IsBuilt() || Radius <= 0.0)
+		{
+			return;
+		}
+
+		const int32 MinCellX = FMath::Clamp((int32)FMath::FloorToDouble((Center.X - Radius - OriginX) / CellSize), 0, NumCellsX - 1);
+		const int32 MaxCellX = FMath::Clamp((int32)FMath::FloorToDouble((Center.X + Radius - OriginX) / CellSize), 0, NumCellsX - 1);
+		const int32 MinCellY = FMath::Clamp((int32)FMath::FloorToDouble((Center.Y - Radius - OriginY) / CellSize), 0, NumCellsY - 1);
+		const int32 MaxCellY = FMath::Clamp((int32)FMath::FloorToDouble((Center.Y + Radius - OriginY) / CellSize), 0, NumCellsY - 1);
+		const double RadiusSquared = Radius * Radius;
+
+		for (int32 CellY = MinCellY; CellY <= MaxCellY; CellY++)
+		{
+			const double CellMinY = OriginY + CellY * CellSize;
+			const double DY = FMath::Max3(CellMinY - Center.Y, 0.0, Center.Y - (CellMinY + CellSize));
+
+			for (int32 CellX = MinCellX; CellX <= MaxCellX; CellX++)
+			{
+				const double CellMinX = OriginX + CellX * CellSize;
+				const double DX = FMath::Max3(CellMinX - Center.X, 0.0, Center.X - (CellMinX + CellSize));
+				if (DX * DX + DY * DY > RadiusSquared)
+				{
+					continue;
+				}
+
+				const int32 Cell = CellY * NumCellsX + CellX;
+				for (int32 k = CellStart[Cell]; k < CellStart[Cell + 1]; k++)
+				{
+					Function(CellInstances[k]);
+				}
+			}
+		}
+	}
+
+private:
+	double OriginX = 0.0;
+	double OriginY = 0.0;
+	double CellSize = 1.0;
+
+	int32 NumCellsX = 0;
+	int32 NumCellsY = 0;
+
+	//Instances of cell c are CellInstances[CellStart[c]] to CellInstances[CellStart[c + 1] - 1], ascending
+	TArray<int32> CellStart;
+	TArray<int32> CellInstances;
+};
@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UWorld;
+
+//What the billboard transforms depend on from the first player's view
+struct INSTANCEDPOINT_API FPointCameraState
+{
+public:
+	bool Capture(UWorld* World);
+
+	bool Equals(const FPointCameraState& Other, float Tolerance) const;
+
+public:
+	FVector Location = FVector::ZeroVector;
+
+	FRotator Rotation = FRotator::ZeroRotator;
+
+	//Billboards face the controller, which may lag the camera
+	FRotator ControllerRotation = FRotator::ZeroRotator;
+
+	float FOV = 0.0f;
+
+	FVector2D ViewportSize = FVector2D::ZeroVector;
+};
+
+/**
+ * Skips billboard updates while the view is still. ShouldUpdate returns true
+ * when the camera moved more than the tolerance since the last update, or
+ * when something else (instances, culling, selection) forced one.
+ */
+struct INSTANCEDPOINT_API FPointViewGate
+{
+public:
+	bool ShouldUpdate(const FPointCameraState& State, float Tolerance);
+
+	void ForceUpdate() { bForceUpdate = true; }
+
+	int32 GetNumSkipped() const { return NumSkipped; }
+
+	int32 GetNumUpdated() const { return NumUpdated; }
+
+private:
+	FPointCameraState LastState;
+
+	bool bForceUpdate = true;
+
+	int32 NumSkipped = 0;
+	int32 NumUpdated = 0;
+};
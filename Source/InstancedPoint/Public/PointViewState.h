@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PointScreenProjector.h"
+#include "PointViewGate.h"
+
+class UWorld;
+
+//Everything the point billboards read from the view, captured once per frame
+struct INSTANCEDPOINT_API FPointViewState
+{
+public:
+	//From the first player controller, its camera manager and the game viewport
+	bool Capture(UWorld* World);
+
+	//From an explicit camera, for worlds without a player (headless runs, tests)
+	void Init(const FVector& Location, const FRotator& Rotation, float FOV, const FVector2D& InViewportSize);
+
+	bool IsValid() const { return bValid; }
+
+public:
+	//What the view gates compare
+	FPointCameraState Camera;
+
+	FVector CameraLocation = FVector::ZeroVector;
+
+	FVector CameraForward = FVector::ForwardVector;
+
+	//Billboards face the controller, which may lag the camera
+	FVector ControllerUp = FVector::UpVector;
+
+	FVector ControllerForward = FVector::ForwardVector;
+
+	FVector2D ViewportSize = FVector2D::ZeroVector;
+
+	FPointScreenProjector Projector;
+
+	//GFrameCounter when captured
+	uint64 FrameNumber = 0;
+
+private:
+	bool bValid = false;
+};
@@ -0,0 +1,120 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Fonts/ShapedTextFwd.h"
+#include "Fonts/SlateFontInfo.h"
+#include "Styling/CoreStyle.h"
+#include "Widgets/SLeafWidget.h"
+#include "PointLabelDeclutter.h"
+#include "PointViewGate.h"
+
+class UHInstancedPointComponent;
+
+/**
+ * Draws the names of every point in name range of its components, in one paint.
+ * Labels are text elements on two layers (shadow, text), so Slate batches them
+ * whatever their number. Shaped text is cached per string and font scale.
+ * Overlapping labels are dropped by priority (selection, distance, NamePriorityMap)
+ * and the placement is only redone when the camera or the shown names change.
+ */
+class INSTANCEDPOINT_API SPointLabelLayer : public SLeafWidget
+{
+public:
+	SLATE_BEGIN_ARGS(SPointLabelLayer)
+		: _Font(FCoreStyle::GetDefaultFontStyle("Regular", 10))
+		, _ColorAndOpacity(FLinearColor::White)
+		, _ShadowColorAndOpacity(FLinearColor(0.0f, 0.0f, 0.0f, 0.75f))
+		, _ShadowOffset(FVector2D(1.0f, 1.0f))
+		, _Pivot(FVector2D(0.5f, 1.0f))
+		, _ScreenOffset(FVector2D(0.0f, -8.0f))
+		, _MaxLabels(0)
+		, _bDeclutter(true)
+		, _DeclutterCellSize(8.0f)
+	{
+		_Visibility = EVisibility::HitTestInvisible;
+	}
+		SLATE_ARGUMENT(FSlateFontInfo, Font)
+		SLATE_ARGUMENT(FLinearColor, ColorAndOpacity)
+		SLATE_ARGUMENT(FLinearColor, ShadowColorAndOpacity)
+		SLATE_ARGUMENT(FVector2D, ShadowOffset)
+		//Point of the label placed on the point, 0..1 of the label size
+		SLATE_ARGUMENT(FVector2D, Pivot)
+		//Offset from the projected point, in slate units
+		SLATE_ARGUMENT(FVector2D, ScreenOffset)
+		//Label budget, 0 for no limit
+		SLATE_ARGUMENT(int32, MaxLabels)
+		//Drop labels overlapping one of higher priority
+		SLATE_ARGUMENT(bool, bDeclutter)
+		//Occupancy grid cell, in slate units. Labels closer than a cell may overlap
+		SLATE_ARGUMENT(float, DeclutterCellSize)
+	SLATE_END_ARGS()
+
+	void Construct(const FArguments& InArgs);
+
+	void AddPointComponent(UHInstancedPointComponent* Component);
+
+	void RemovePointComponent(UHInstancedPointComponent* Component);
+
+	void SetFont(const FSlateFontInfo& InFont);
+
+	void SetColorAndOpacity(const FLinearColor& InColor, const FLinearColor& InShadowColor, const FVector2D& InShadowOffset);
+
+	void SetPlacement(const FVector2D& InPivot, const FVector2D& InScreenOffset);
+
+	void SetMaxLabels(int32 InMaxLabels);
+
+	void SetDeclutter(bool bInDeclutter, float InCellSize);
+
+	//Place the labels again on the next paint
+	void Invalidate() { LabelGate.ForceUpdate(); }
+
+	//Labels drawn by the last paint
+	int32 GetNumLabelsDrawn() const { return NumLabelsDrawn; }
+
+	virtual int32 OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const override;
+
+protected:
+	virtual FVector2D ComputeDesiredSize(float LayoutScaleMultiplier) const override;
+
+private:
+	struct FPlacedLabel
+	{
+		FShapedGlyphSequenceRef Shaped;
+		FVector2D Offset;
+		FVector2D Size;
+	};
+
+	//Shape Text once for the current font and scale
+	FShapedGlyphSequenceRef GetShapedText(const FString& Text, float FontScale) const;
+
+	//Project the shown names of every component and keep those that fit
+	void PlaceLabels(const FGeometry& AllottedGeometry) const;
+
+	//Changes with the components, their shown names, name versions and the layer size
+	uint32 GetLabelContentHash(const FGeometry& AllottedGeometry) const;
+
+	TArray<TWeakObjectPtr<UHInstancedPointComponent>> Components;
+
+	FSlateFontInfo Font;
+	FLinearColor ColorAndOpacity;
+	FLinearColor ShadowColorAndOpacity;
+	FVector2D ShadowOffset;
+	FVector2D Pivot;
+	FVector2D ScreenOffset;
+	int32 MaxLabels = 0;
+	bool bDeclutter = true;
+	float DeclutterCellSize = 8.0f;
+
+	mutable FPointViewGate LabelGate;
+	mutable uint32 LabelContentHash = 0;
+	mutable FPointLabelDeclutter Declutter;
+	mutable TArray<FPlacedLabel> CandidateLabels;
+	mutable TArray<int32> PlacedSlots;
+	mutable TArray<FPlacedLabel> PlacedLabels;
+
+	mutable TMap<FString, FShapedGlyphSequenceRef> ShapedTextCache;
+	mutable float CachedFontScale = 0.0f;
+	mutable int32 NumLabelsDrawn = 0;
+};
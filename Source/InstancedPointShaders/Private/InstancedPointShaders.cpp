@@ -0,0 +1,26 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "CoreMinimal.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/Paths.h"
+#include "Modules/ModuleManager.h"
+#include "ShaderCore.h"
+
+/**
+ * Only maps the plugin shader directory. Shader source mappings must be added before the
+ * shaders are compiled, at PostConfigInit, while the runtime module loads at Default.
+ */
+class FInstancedPointShadersModule : public IModuleInterface
+{
+public:
+	virtual void StartupModule() override
+	{
+		//Lets materials include /Plugin/InstancedPoint/Private/InstancedPointBillboard.ush and InstancedPointVisibility.ush
+		if (TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("InstancedPoint")))
+		{
+			AddShaderSourceDirectoryMapping(TEXT("/Plugin/InstancedPoint"), FPaths::Combine(Plugin->GetBaseDir(), TEXT("Shaders")));
+		}
+	}
+};
+
+IMPLEMENT_MODULE(FInstancedPointShadersModule, InstancedPointShaders)